@@ -0,0 +1,32 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_ZHUYIN_ZHUYIN_PUBLIC_H_
+#define _FCITX5_ZHUYIN_ZHUYIN_PUBLIC_H_
+
+#include <cstddef>
+#include <fcitx/addoninstance.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Convert keys typed with the configured layout to the best sentence.
+FCITX_ADDON_DECLARE_FUNCTION(Zhuyin, convert,
+                             std::string(const std::string &keys));
+
+// Convert keys with the loaded model after the current event is handled,
+// callback is invoked on the main thread.
+FCITX_ADDON_DECLARE_FUNCTION(
+    Zhuyin, convertAsync,
+    void(const std::string &keys,
+         std::function<void(const std::string &)> callback));
+
+// Return at most n candidates that start at the beginning of keys.
+FCITX_ADDON_DECLARE_FUNCTION(Zhuyin, candidates,
+                             std::vector<std::string>(const std::string &keys,
+                                                      size_t n));
+
+#endif // _FCITX5_ZHUYIN_ZHUYIN_PUBLIC_H_
@@ -0,0 +1,54 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "zhuyinarena.h"
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+namespace fcitx {
+
+namespace {
+
+// A key event with a full buffer uses a few kB, more than this spills to the
+// heap until the scope ends.
+constexpr size_t arenaSize = 16384;
+
+struct Arena {
+    std::array<std::byte, arenaSize> buffer;
+    std::pmr::monotonic_buffer_resource resource{
+        buffer.data(), buffer.size(), std::pmr::new_delete_resource()};
+};
+
+// Allocated on the first scope of each thread, most threads never have one.
+thread_local std::unique_ptr<Arena> arena;
+thread_local size_t depth = 0;
+
+} // namespace
+
+std::pmr::memory_resource *ZhuyinArena::resource() {
+    if (!depth) {
+        return std::pmr::new_delete_resource();
+    }
+    return &arena->resource;
+}
+
+ZhuyinArenaScope::ZhuyinArenaScope() {
+    if (!arena) {
+        arena = std::make_unique<Arena>();
+    }
+    depth += 1;
+}
+
+ZhuyinArenaScope::~ZhuyinArenaScope() {
+    depth -= 1;
+    if (!depth) {
+        arena->resource.release();
+    }
+}
+
+} // namespace fcitx
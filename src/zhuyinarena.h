@@ -0,0 +1,37 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_ZHUYIN_ZHUYINARENA_H_
+#define _FCITX5_ZHUYIN_ZHUYINARENA_H_
+
+#include <memory_resource>
+
+namespace fcitx {
+
+// Memory for temporaries that never outlive the key event being handled,
+// e.g. preedit strings that are copied into Text anyway.
+//
+// Within a ZhuyinArenaScope, allocations are taken from a per-thread
+// monotonic buffer and only released when the outermost scope ends. Outside
+// of any scope it is the default heap, so code using it is also safe to call
+// from anywhere else.
+class ZhuyinArena {
+public:
+    static std::pmr::memory_resource *resource();
+};
+
+class ZhuyinArenaScope {
+public:
+    ZhuyinArenaScope();
+    ~ZhuyinArenaScope();
+
+    ZhuyinArenaScope(const ZhuyinArenaScope &) = delete;
+    ZhuyinArenaScope &operator=(const ZhuyinArenaScope &) = delete;
+};
+
+} // namespace fcitx
+
+#endif // _FCITX5_ZHUYIN_ZHUYINARENA_H_
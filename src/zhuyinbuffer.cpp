@@ -5,6 +5,7 @@
  *
  */
 #include "zhuyinbuffer.h"
+#include "zhuyinarena.h"
 #include "zhuyincandidate.h"
 #include "zhuyinsection.h"
 #include <cassert>
@@ -12,15 +13,19 @@
 #include <cstdint>
 #include <fcitx-utils/charutils.h>
 #include <fcitx-utils/textformatflags.h>
+#include <fcitx-utils/utf8.h>
 #include <fcitx/text.h>
 #include <functional>
 #include <glib.h>
 #include <iterator>
 #include <limits>
 #include <memory>
+#include <memory_resource>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 #include <zhuyin.h>
 
 namespace fcitx {
@@ -134,7 +139,10 @@ void ZhuyinBuffer::type(uint32_t c) {
 
             auto next = std::next(cursor_);
             auto offset = cursor_->cursorByChar();
-            auto subText = cursor_->userInput().substr(offset);
+            std::pmr::string subText(
+                std::string_view(cursor_->userInput()).substr(offset),
+                ZhuyinArena::resource());
+            auto choices = cursor_->choicesFrom(offset);
 
             cursor_->erase(offset, cursor_->size());
 
@@ -144,7 +152,7 @@ void ZhuyinBuffer::type(uint32_t c) {
             // Add split section.
             auto subZhuyin = sections_.emplace(next, ZhuyinSectionType::Zhuyin,
                                                provider_, this);
-            subZhuyin->type(subText);
+            subZhuyin->insert(subText, std::move(choices));
         }
     }
 }
@@ -186,7 +194,7 @@ void ZhuyinBuffer::backspace() {
             next->sectionType() == ZhuyinSectionType::Zhuyin) {
             // Merge cursor_ and next.
             auto currentSize = cursor_->size();
-            cursor_->type(next->userInput());
+            cursor_->insert(next->userInput(), next->choicesFrom(0));
             cursor_->setCursor(currentSize);
             sections_.erase(next);
         }
@@ -202,17 +210,32 @@ void ZhuyinBuffer::del() {
 Text ZhuyinBuffer::preedit() const {
     Text text;
     text.setCursor(0);
+    // All sections have the same format, so they are built in the arena and
+    // copied into text as a single piece.
+    std::pmr::string preedit(ZhuyinArena::resource());
     for (auto iter = std::next(sections_.begin()), end = sections_.end();
          iter != end; ++iter) {
-        auto [preedit, cursor] = iter->preeditWithCursor();
+        const auto start = preedit.size();
+        const auto cursor = iter->appendPreedit(preedit);
         if (cursor_ == iter) {
-            text.setCursor(text.textLength() + cursor);
+            text.setCursor(start + cursor);
         }
-        text.append(preedit, TextFormatFlag::Underline);
+    }
+    if (!preedit.empty()) {
+        text.append(std::string(preedit), TextFormatFlag::Underline);
     }
     return text;
 }
 
+size_t ZhuyinBuffer::preeditLength() const {
+    size_t length = 0;
+    for (auto iter = std::next(sections_.begin()), end = sections_.end();
+         iter != end; ++iter) {
+        length += iter->preeditLength();
+    }
+    return length;
+}
+
 std::string ZhuyinBuffer::rawText() const {
     std::string result;
     for (auto iter = std::next(sections_.begin()), end = sections_.end();
@@ -222,6 +245,32 @@ std::string ZhuyinBuffer::rawText() const {
     return result;
 }
 
+bool ZhuyinBuffer::guessPending() const {
+    for (auto iter = std::next(sections_.begin()), end = sections_.end();
+         iter != end; ++iter) {
+        if (iter->guessPending()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t ZhuyinBuffer::settledPreeditSize() const {
+    std::pmr::string preedit(ZhuyinArena::resource());
+    for (auto iter = std::next(sections_.begin()), end = sections_.end();
+         iter != end && !iter->guessPending(); ++iter) {
+        iter->appendPreedit(preedit);
+    }
+    return preedit.size();
+}
+
+void ZhuyinBuffer::finishGuess() const {
+    for (auto iter = std::next(sections_.begin()), end = sections_.end();
+         iter != end; ++iter) {
+        iter->finishGuess();
+    }
+}
+
 void ZhuyinBuffer::learn() {
     for (auto iter = std::next(sections_.begin()), end = sections_.end();
          iter != end; ++iter) {
@@ -229,6 +278,39 @@ void ZhuyinBuffer::learn() {
     }
 }
 
+std::string ZhuyinBuffer::convert(std::string_view keys) {
+    std::string result;
+    reset();
+    for (auto c : utf8::MakeUTF8CharRange(keys)) {
+        type(c);
+        if (preeditLength() > MAX_INPUT_LENGTH) {
+            result.append(text());
+            reset();
+        }
+    }
+    result.append(text());
+    reset();
+    return result;
+}
+
+std::vector<ZhuyinSentence> ZhuyinBuffer::sentences() const {
+    std::vector<ZhuyinSentence> result;
+    for (const auto &section : sections_) {
+        if (section.sectionType() == ZhuyinSectionType::Zhuyin) {
+            result.push_back({section.userInput(), section.choicesFrom(0)});
+        }
+    }
+    return result;
+}
+
+void ZhuyinBuffer::learn(const std::vector<ZhuyinSentence> &sentences) {
+    for (const auto &sentence : sentences) {
+        ZhuyinSection section(ZhuyinSectionType::Zhuyin, provider_, this);
+        section.insert(sentence.input, sentence.choices);
+        section.learn();
+    }
+}
+
 void ZhuyinBuffer::reset() {
     sections_.erase(std::next(sections_.begin()), sections_.end());
     cursor_ = sections_.begin();
@@ -272,7 +354,10 @@ void ZhuyinBuffer::setZhuyinSymbolTo(SectionIterator iter, size_t offset,
     auto next = std::next(iter);
     auto beforeSize = offset;
     auto chr = iter->charAt(offset);
-    auto after = iter->userInput().substr(offset + 1);
+    std::pmr::string after(
+        std::string_view(iter->userInput()).substr(offset + 1),
+        ZhuyinArena::resource());
+    auto choices = iter->choicesFrom(offset + 1);
     if (beforeSize == 0) {
         sections_.erase(iter);
     } else {
@@ -284,7 +369,7 @@ void ZhuyinBuffer::setZhuyinSymbolTo(SectionIterator iter, size_t offset,
     if (!after.empty()) {
         auto newSection =
             sections_.emplace(next, ZhuyinSectionType::Zhuyin, provider_, this);
-        newSection->type(after);
+        newSection->insert(after, std::move(choices));
     }
     cursor_ = newSymbol;
 }
@@ -317,4 +402,34 @@ std::string ZhuyinBuffer::dump() const {
     return sstream.str();
 }
 
+std::string ZhuyinBuffer::dumpShape() const {
+    std::stringstream sstream;
+    sstream << "ZhuyinBuffer(";
+    size_t index = 0;
+    for (const auto &section : sections_) {
+        // Cursor is marked with "*", it may be on the place holder.
+        if (&section == &*cursor_) {
+            sstream << "*";
+        }
+        if (index == 0) {
+            index += 1;
+            continue;
+        }
+        switch (section.sectionType()) {
+        case ZhuyinSectionType::Zhuyin:
+            sstream << "<Zhuyin,Size:" << section.size()
+                    << ",Parsed:" << section.parsedZhuyinLength()
+                    << ",Choices:" << section.choicesFrom(0).size()
+                    << ",Cursor:" << section.cursor() << ">";
+            break;
+        case ZhuyinSectionType::Symbol:
+            sstream << "<Symbol,Size:" << section.size() << ">";
+            break;
+        }
+        index += 1;
+    }
+    sstream << "Sections:" << index - 1 << ")";
+    return sstream.str();
+}
+
 } // namespace fcitx
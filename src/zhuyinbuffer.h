@@ -11,12 +11,16 @@
 #include "zhuyinsymbol.h"
 #include <cstddef>
 #include <cstdint>
+#include <ctime>
+#include <fcitx-utils/event.h>
 #include <fcitx-utils/misc.h>
 #include <fcitx/text.h>
 #include <functional>
 #include <list>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <zhuyin.h>
 
 namespace fcitx {
@@ -30,8 +34,17 @@ public:
     virtual zhuyin_context_t *context() = 0;
     virtual bool isZhuyin() const = 0;
     virtual const ZhuyinSymbol &symbol() const = 0;
+    // Usec a sentence guess may take when a key is typed, a section that
+    // guessed slower than this defers the guess until finishGuess. 0 means
+    // no limit.
+    virtual uint64_t guessBudget() const { return 0; }
+    // Monotonic clock in usec used to time guesses against guessBudget.
+    virtual uint64_t guessClock() const { return now(CLOCK_MONOTONIC); }
 };
 
+// Buffer is committed once its preedit is longer than this many characters.
+constexpr size_t MAX_INPUT_LENGTH = 30;
+
 // Class that manages a list of ZhuyinSection.
 // There is no zhuyin section that close to anotehr zhuyin section.
 // An empty place holder symbol section is places at the beginning,
@@ -45,11 +58,18 @@ public:
     // Clear the buffer.
     void reset();
 
-    std::string text() const { return preedit().toStringForCommit(); }
+    // Text to commit, pending guesses are finished first.
+    std::string text() const {
+        finishGuess();
+        return preedit().toStringForCommit();
+    }
     std::string rawText() const;
     bool isCursorAtTheEnd() const;
 
     Text preedit() const;
+    // Same as utf8::length(text()), without building the Text or finishing
+    // pending guesses.
+    size_t preeditLength() const;
 
     bool moveCursorLeft();
     bool moveCursorRight();
@@ -58,6 +78,22 @@ public:
     void del();
     void backspace();
     void learn();
+    // Type keys into the buffer and return the text they produce, committed
+    // in pieces whenever the preedit exceeds MAX_INPUT_LENGTH, the same way
+    // as the engine does. The buffer is reset before and after. keys needs
+    // to be valid UTF-8.
+    std::string convert(std::string_view keys);
+    // Zhuyin sections of the buffer, to be learned later with learn(const
+    // std::vector<ZhuyinSentence> &).
+    std::vector<ZhuyinSentence> sentences() const;
+    // Type every sentence again in its own section and train the model with
+    // it. The buffer itself is not changed.
+    void learn(const std::vector<ZhuyinSentence> &sentences);
+    bool guessPending() const;
+    // Size in bytes of the beginning of preedit that is final, which is
+    // everything before the first section with a pending guess.
+    size_t settledPreeditSize() const;
+    void finishGuess() const;
 
     void showCandidate(
         const std::function<void(std::unique_ptr<ZhuyinCandidate>)> &callback);
@@ -65,6 +101,9 @@ public:
                            std::string symbol);
 
     std::string dump() const;
+    // Same as dump, but only with the type, length and number of choices of
+    // sections. Safe to be written to log.
+    std::string dumpShape() const;
 
     auto instance() const { return instance_.get(); }
 
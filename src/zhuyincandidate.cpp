@@ -21,27 +21,26 @@ namespace fcitx {
 ZhuyinSectionCandidate::ZhuyinSectionCandidate(SectionIterator section,
                                                unsigned int i)
 
-    : section_(section), index_(i) {
-    lookup_candidate_t *candidate = nullptr;
-    if (!zhuyin_get_candidate(section->instance(), i, &candidate)) {
+    : section_(section), index_(i), revision_(section->candidateRevision()) {
+    if (!zhuyin_get_candidate(section->instance(), i, &candidate_)) {
         throw std::runtime_error("Failed to get candidate");
     }
 
     const gchar *word = nullptr;
-    if (!zhuyin_get_candidate_string(section->instance(), candidate, &word)) {
+    if (!zhuyin_get_candidate_string(section->instance(), candidate_, &word)) {
         throw std::runtime_error("Failed to get string");
     }
     setText(Text(word));
 }
 
 void ZhuyinSectionCandidate::select(InputContext * /*inputContext*/) const {
-    lookup_candidate_t *candidate = nullptr;
-    if (!zhuyin_get_candidate(section_->instance(), index_, &candidate)) {
+    auto *candidate = candidate_;
+    // Candidate list may be refreshed since this candidate is created.
+    if (section_->candidateRevision() != revision_ &&
+        !zhuyin_get_candidate(section_->instance(), index_, &candidate)) {
         return;
     }
-    auto newOffset = zhuyin_choose_candidate(section_->instance(),
-                                             section_->prevChar(), candidate);
-    zhuyin_guess_sentence(section_->instance());
+    auto newOffset = section_->chooseCandidate(section_->prevChar(), candidate);
     section_->setCursor(newOffset);
     emit<ZhuyinSectionCandidate::selected>(section_);
     emit<ZhuyinCandidate::selected>();
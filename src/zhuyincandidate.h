@@ -9,9 +9,11 @@
 
 #include "zhuyinsection.h"
 #include <cstddef>
+#include <cstdint>
 #include <fcitx-utils/connectableobject.h>
 #include <fcitx/candidatelist.h>
 #include <string>
+#include <zhuyin.h>
 
 namespace fcitx {
 
@@ -38,6 +40,9 @@ private:
     FCITX_DEFINE_SIGNAL(ZhuyinSectionCandidate, selected);
     SectionIterator section_;
     unsigned int index_;
+    // Owned by the section instance, only valid with the same revision.
+    lookup_candidate_t *candidate_ = nullptr;
+    uint64_t revision_;
 };
 
 // Candidate for symbol section.
@@ -0,0 +1,249 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "zhuyinbuffer.h"
+#include "zhuyinoptions.h"
+#include "zhuyinsymbol.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fcitx-utils/misc.h>
+#include <fcitx-utils/standardpaths.h>
+#include <fcitx-utils/utf8.h>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <istream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <zhuyin.h>
+
+using namespace fcitx;
+
+namespace {
+
+constexpr size_t BATCH_SIZE = 64;
+
+void usage(const char *argv0) {
+    std::cout
+        << "Usage: " << argv0 << " [-j <jobs>] [-l <layout>] [-T] [-n]"
+        << " [-d <datadir>] [-u <userdir>] [file...]\n"
+        << "Convert recorded key sequences to text, one line per sequence.\n"
+        << "Read from standard input if no file is given.\n\n"
+        << "-j: number of worker threads, default to number of cores\n"
+        << "-l: layout name, same as the configuration, default to "
+           "\"Standard\"\n"
+        << "-T: do not require tone in zhuyin\n"
+        << "-n: do not load user dictionary\n"
+        << "-d: directory that contains table.conf\n"
+        << "-u: user data directory\n"
+        << "-h: show this help\n";
+}
+
+class ConvertProvider : public ZhuyinProviderInterface {
+public:
+    ConvertProvider(zhuyin_context_t *context, bool isZhuyin,
+                    const ZhuyinSymbol &symbol)
+        : context_(context), isZhuyin_(isZhuyin), symbol_(symbol) {}
+
+    zhuyin_context_t *context() override { return context_; }
+    bool isZhuyin() const override { return isZhuyin_; }
+    const ZhuyinSymbol &symbol() const override { return symbol_; }
+
+private:
+    zhuyin_context_t *context_;
+    bool isZhuyin_;
+    const ZhuyinSymbol &symbol_;
+};
+
+struct ConvertJob {
+    std::string systemDir;
+    std::string userDir;
+    bool loadUserDictionary = true;
+    ZhuyinContextOptions options;
+    ZhuyinSymbol symbol;
+    std::vector<std::string> input;
+    std::vector<std::string> output;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> keys{0};
+    std::atomic<bool> failed{false};
+    // Time spent on conversion by each worker, excluding model loading.
+    std::vector<double> elapsed;
+};
+
+std::string convert(ZhuyinBuffer &buffer, const std::string &line,
+                    size_t &keys) {
+    if (!utf8::validate(line)) {
+        return line;
+    }
+    keys += utf8::length(line);
+    return buffer.convert(line);
+}
+
+void worker(ConvertJob *job, size_t id) {
+    // zhuyin_context_t keeps lookup state used by guessing, so it can not be
+    // shared between threads. Each worker loads its own copy of the model.
+    UniqueCPtr<zhuyin_context_t, zhuyin_fini> context(
+        zhuyin_init(job->systemDir.data(), job->userDir.data()));
+    if (!context) {
+        job->failed = true;
+        return;
+    }
+    if (job->loadUserDictionary) {
+        zhuyin_load_phrase_library(context.get(), USER_DICTIONARY);
+    }
+    job->options.apply(context.get());
+    ConvertProvider provider(context.get(), job->options.isZhuyin,
+                             job->symbol);
+    ZhuyinBuffer buffer(&provider);
+
+    size_t keys = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        auto begin = job->next.fetch_add(BATCH_SIZE);
+        if (begin >= job->input.size()) {
+            break;
+        }
+        auto end = std::min(begin + BATCH_SIZE, job->input.size());
+        for (auto i = begin; i < end; i++) {
+            job->output[i] = convert(buffer, job->input[i], keys);
+        }
+    }
+    job->elapsed[id] = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    job->keys += keys;
+}
+
+void readLines(std::istream &in, std::vector<std::string> &lines) {
+    std::string line;
+    while (std::getline(in, line)) {
+        lines.push_back(std::move(line));
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    ConvertJob job;
+    size_t jobs = std::max(1U, std::thread::hardware_concurrency());
+    bool needTone = true;
+    const char *layout = "Standard";
+
+    int c;
+    while ((c = getopt(argc, argv, "j:l:Tnd:u:h")) != -1) {
+        switch (c) {
+        case 'j':
+            jobs = std::max(1, std::atoi(optarg));
+            break;
+        case 'l':
+            layout = optarg;
+            break;
+        case 'T':
+            needTone = false;
+            break;
+        case 'n':
+            job.loadUserDictionary = false;
+            break;
+        case 'd':
+            job.systemDir = optarg;
+            break;
+        case 'u':
+            job.userDir = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!job.options.setLayout(layout)) {
+        std::cerr << "Unknown layout: " << layout << '\n';
+        return 1;
+    }
+    if (job.options.isZhuyin && needTone) {
+        job.options.options |= FORCE_TONE;
+    }
+
+    const auto &sp = StandardPaths::global();
+    if (job.systemDir.empty()) {
+        auto tablePath =
+            sp.locate(StandardPathsType::PkgData, "zhuyin/table.conf");
+        if (tablePath.empty()) {
+            std::cerr << "Failed to find zhuyin/table.conf\n";
+            return 1;
+        }
+        job.systemDir = tablePath.parent_path().string();
+    }
+    if (job.userDir.empty()) {
+        job.userDir =
+            (sp.userDirectory(StandardPathsType::PkgData) / "zhuyin").string();
+    }
+
+    job.symbol.reset();
+    if (auto symbolPath = sp.locate(StandardPathsType::PkgData,
+                                    "zhuyin/easysymbols.txt");
+        !symbolPath.empty()) {
+        std::ifstream in(symbolPath);
+        job.symbol.load(in);
+    }
+
+    if (optind >= argc) {
+        readLines(std::cin, job.input);
+    }
+    for (int i = optind; i < argc; i++) {
+        if (std::string_view(argv[i]) == "-") {
+            readLines(std::cin, job.input);
+            continue;
+        }
+        std::ifstream in(argv[i]);
+        if (!in) {
+            std::cerr << "Failed to open " << argv[i] << '\n';
+            return 1;
+        }
+        readLines(in, job.input);
+    }
+    job.output.resize(job.input.size());
+    jobs = std::min(jobs, std::max<size_t>(1, job.input.size() / BATCH_SIZE));
+    job.elapsed.resize(jobs);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < jobs; i++) {
+        threads.emplace_back(worker, &job, i);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    auto total = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+    if (job.failed) {
+        std::cerr << "Failed to load model from " << job.systemDir << '\n';
+        return 1;
+    }
+
+    for (const auto &line : job.output) {
+        std::cout << line << '\n';
+    }
+
+    // Workers run in parallel, so the slowest one bounds the throughput.
+    auto elapsed = *std::max_element(job.elapsed.begin(), job.elapsed.end());
+    std::cerr << "Converted " << job.input.size() << " lines, " << job.keys
+              << " keys with " << jobs << " workers in " << total
+              << "s (conversion " << elapsed << "s), "
+              << (elapsed > 0 ? job.keys / elapsed : 0) << " keys/s\n";
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "zhuyinconverter.h"
+#include "zhuyinbuffer.h"
+#include "zhuyinoptions.h"
+#include "zhuyinsymbol.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fcitx-utils/misc.h>
+#include <fcitx-utils/utf8.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <zhuyin.h>
+
+namespace fcitx {
+
+namespace {
+
+class WorkerProvider : public ZhuyinProviderInterface {
+public:
+    WorkerProvider(zhuyin_context_t *context,
+                   std::shared_ptr<const ZhuyinConverterSnapshot> snapshot)
+        : context_(context), snapshot_(std::move(snapshot)) {}
+
+    zhuyin_context_t *context() override { return context_; }
+    bool isZhuyin() const override { return snapshot_->options.isZhuyin; }
+    const ZhuyinSymbol &symbol() const override { return *snapshot_->symbol; }
+
+private:
+    zhuyin_context_t *context_;
+    std::shared_ptr<const ZhuyinConverterSnapshot> snapshot_;
+};
+
+std::string convertKeys(ZhuyinBuffer &buffer, const std::string &keys) {
+    if (!utf8::validate(keys)) {
+        return {};
+    }
+    return buffer.convert(keys);
+}
+
+} // namespace
+
+ZhuyinConverter::ZhuyinConverter(std::string systemDir, std::string userDir,
+                                 size_t threads)
+    : systemDir_(std::move(systemDir)), userDir_(std::move(userDir)) {
+    auto snapshot = std::make_shared<ZhuyinConverterSnapshot>();
+    snapshot->symbol = std::make_shared<ZhuyinSymbol>();
+    snapshot_ = std::move(snapshot);
+    for (size_t i = 0; i < std::max<size_t>(1, threads); i++) {
+        threads_.emplace_back(&ZhuyinConverter::run, this);
+    }
+}
+
+ZhuyinConverter::~ZhuyinConverter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    condition_.notify_all();
+    for (auto &thread : threads_) {
+        thread.join();
+    }
+}
+
+void ZhuyinConverter::publish(const ZhuyinContextOptions &options,
+                              std::shared_ptr<const ZhuyinSymbol> symbol) {
+    auto snapshot = std::make_shared<ZhuyinConverterSnapshot>();
+    snapshot->options = options;
+    snapshot->symbol = symbol ? std::move(symbol)
+                              : std::make_shared<const ZhuyinSymbol>();
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshot->version = snapshot_->version + 1;
+    snapshot->userDictionaryVersion = snapshot_->userDictionaryVersion;
+    snapshot->modelVersion = snapshot_->modelVersion;
+    snapshot_ = std::move(snapshot);
+}
+
+void ZhuyinConverter::publishUserDictionary() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto snapshot = std::make_shared<ZhuyinConverterSnapshot>(*snapshot_);
+    snapshot->version += 1;
+    snapshot->userDictionaryVersion += 1;
+    snapshot_ = std::move(snapshot);
+}
+
+void ZhuyinConverter::publishModel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto snapshot = std::make_shared<ZhuyinConverterSnapshot>(*snapshot_);
+    snapshot->version += 1;
+    snapshot->modelVersion += 1;
+    snapshot_ = std::move(snapshot);
+}
+
+uint64_t ZhuyinConverter::version() const { return snapshot()->version; }
+
+std::shared_ptr<const ZhuyinConverterSnapshot>
+ZhuyinConverter::snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return snapshot_;
+}
+
+void ZhuyinConverter::convert(std::string keys, Callback callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back({std::move(keys), std::move(callback)});
+    }
+    condition_.notify_one();
+}
+
+void ZhuyinConverter::setConvertedHook(
+    std::function<void(const std::string &)> hook) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    convertedHook_ = std::move(hook);
+}
+
+void ZhuyinConverter::run() {
+    // Everything below is confined to this thread.
+    UniqueCPtr<zhuyin_context_t, zhuyin_fini> context;
+    std::unique_ptr<WorkerProvider> provider;
+    std::unique_ptr<ZhuyinBuffer> buffer;
+    uint64_t version = 0;
+    uint64_t userDictionaryVersion = 0;
+    uint64_t modelVersion = 0;
+    bool loaded = false;
+
+    while (true) {
+        Job job;
+        std::shared_ptr<const ZhuyinConverterSnapshot> snapshot;
+        std::function<void(const std::string &)> hook;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this]() { return quit_ || !jobs_.empty(); });
+            if (quit_) {
+                return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+            snapshot = snapshot_;
+            hook = convertedHook_;
+        }
+
+        if (!loaded || snapshot->modelVersion != modelVersion) {
+            // Buffer holds instances of the old context.
+            buffer.reset();
+            provider.reset();
+            context.reset(zhuyin_init(systemDir_.data(), userDir_.data()));
+            if (context) {
+                zhuyin_load_phrase_library(context.get(), USER_DICTIONARY);
+            }
+            userDictionaryVersion = snapshot->userDictionaryVersion;
+            modelVersion = snapshot->modelVersion;
+            loaded = true;
+        }
+        if (context && (!buffer || snapshot->version != version)) {
+            // Buffer holds instances of the old state.
+            buffer.reset();
+            if (snapshot->userDictionaryVersion != userDictionaryVersion) {
+                zhuyin_unload_phrase_library(context.get(), USER_DICTIONARY);
+                zhuyin_load_phrase_library(context.get(), USER_DICTIONARY);
+                userDictionaryVersion = snapshot->userDictionaryVersion;
+            }
+            snapshot->options.apply(context.get());
+            provider =
+                std::make_unique<WorkerProvider>(context.get(), snapshot);
+            buffer = std::make_unique<ZhuyinBuffer>(provider.get());
+        }
+        version = snapshot->version;
+
+        auto result = buffer ? convertKeys(*buffer, job.keys) : std::string();
+        if (hook) {
+            hook(job.keys);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (snapshot_->version != version) {
+                // Published while converting, convert again before the jobs
+                // queued after it.
+                jobs_.push_front(std::move(job));
+                continue;
+            }
+        }
+        job.callback(std::move(result));
+    }
+}
+
+} // namespace fcitx
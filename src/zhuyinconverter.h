@@ -0,0 +1,101 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_ZHUYIN_ZHUYINCONVERTER_H_
+#define _FCITX5_ZHUYIN_ZHUYINCONVERTER_H_
+
+#include "zhuyinoptions.h"
+#include "zhuyinsymbol.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fcitx {
+
+// State that workers need to convert, replaced as a whole and never modified
+// once published.
+struct ZhuyinConverterSnapshot {
+    uint64_t version = 0;
+    // Bumped when user dictionary is saved, only then workers read it again.
+    uint64_t userDictionaryVersion = 0;
+    // Bumped when user files are rewritten, workers load a new context.
+    uint64_t modelVersion = 0;
+    ZhuyinContextOptions options;
+    std::shared_ptr<const ZhuyinSymbol> symbol;
+};
+
+// Convert key sequences on worker threads.
+//
+// zhuyin_context_t keeps the scratch state used by guessing, so it can not
+// be shared. Every worker owns a context, which is a full copy of the model,
+// and only touches it on its own thread. The addon does not use it for that
+// reason, it converts on the main loop with the model it has loaded.
+//
+// Changes are published as a new snapshot and picked up before the next job.
+// New options are applied to the existing context, and a saved user
+// dictionary only reloads the user phrase library. libzhuyin saves user
+// files by renaming a temporary file, so a reload always sees a complete
+// dictionary. The user bigram is only read by zhuyin_init, so learned
+// bigram counts reach a worker when it is created. A result converted with a
+// snapshot that is replaced before it is delivered is dropped, and the job
+// is converted again with the new one.
+class ZhuyinConverter {
+public:
+    using Callback = std::function<void(std::string)>;
+
+    ZhuyinConverter(std::string systemDir, std::string userDir,
+                    size_t threads);
+    // Jobs that are not started yet are dropped without callback.
+    ~ZhuyinConverter();
+
+    // Publish new options and symbols.
+    void publish(const ZhuyinContextOptions &options,
+                 std::shared_ptr<const ZhuyinSymbol> symbol);
+    // Publish the user dictionary saved to disk.
+    void publishUserDictionary();
+    // Publish user files rewritten as a whole, e.g. by compaction, which
+    // changes the token ids used by the user bigram.
+    void publishModel();
+    uint64_t version() const;
+
+    // Callback is invoked on worker thread, with empty string if the model
+    // can not be loaded.
+    void convert(std::string keys, Callback callback);
+    // Called on the worker with the keys of a job once they are converted,
+    // before the result is checked against the latest snapshot. For tests,
+    // set it before the first convert.
+    void setConvertedHook(std::function<void(const std::string &)> hook);
+
+private:
+    struct Job {
+        std::string keys;
+        Callback callback;
+    };
+
+    void run();
+    std::shared_ptr<const ZhuyinConverterSnapshot> snapshot() const;
+
+    const std::string systemDir_;
+    const std::string userDir_;
+    mutable std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<Job> jobs_;
+    std::shared_ptr<const ZhuyinConverterSnapshot> snapshot_;
+    bool quit_ = false;
+    std::function<void(const std::string &)> convertedHook_;
+    std::vector<std::thread> threads_;
+};
+
+} // namespace fcitx
+
+#endif // _FCITX5_ZHUYIN_ZHUYINCONVERTER_H_
@@ -6,13 +6,21 @@
  */
 #include "zhuyinengine.h"
 #include "quickphrase_public.h"
+#include "zhuyinarena.h"
 #include "zhuyincandidate.h"
+#include "zhuyinoptions.h"
+#include "zhuyinuserdict.h"
+#include "zhuyinwatchdog.h"
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <ctime>
 #include <fcitx-config/iniparser.h>
 #include <fcitx-config/rawconfig.h>
 #include <fcitx-utils/capabilityflags.h>
 #include <fcitx-utils/charutils.h>
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/eventdispatcher.h>
 #include <fcitx-utils/fdstreambuf.h>
 #include <fcitx-utils/fs.h>
 #include <fcitx-utils/i18n.h>
@@ -23,6 +31,7 @@
 #include <fcitx-utils/misc.h>
 #include <fcitx-utils/standardpaths.h>
 #include <fcitx-utils/stringutils.h>
+#include <fcitx-utils/unixfd.h>
 #include <fcitx-utils/utf8.h>
 #include <fcitx/addoninstance.h>
 #include <fcitx/candidatelist.h>
@@ -33,34 +42,140 @@
 #include <fcitx/userinterface.h>
 #include <fcitx/userinterfacemanager.h>
 #include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <future>
 #include <istream>
 #include <limits>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 #include <zhuyin.h>
 
 namespace {
 
 FCITX_DEFINE_LOG_CATEGORY(zhuyin, "zhuyin");
 #define ZHUYIN_DEBUG() FCITX_LOGC(zhuyin, Debug)
+#define ZHUYIN_INFO() FCITX_LOGC(zhuyin, Info)
+#define ZHUYIN_WARN() FCITX_LOGC(zhuyin, Warn)
 } // namespace
 
 namespace fcitx {
 
-constexpr size_t MAX_INPUT_LENGTH = 30;
+namespace {
+
+ZhuyinContextOptions contextOptionsFor(Scheme layout, bool needTone,
+                                       const FuzzyConfig &fuzzy) {
+    ZhuyinContextOptions result;
+    // Enum names are the same as the layout names.
+    result.setLayout(SchemeToString(layout));
+
+    pinyin_option_t options = USE_TONE | ZHUYIN_CORRECT_ALL;
+    if (result.isZhuyin && needTone) {
+        options |= FORCE_TONE;
+    }
+    if (*fuzzy.fuzzyCCh) {
+        options |= PINYIN_AMB_C_CH;
+    }
+    if (*fuzzy.fuzzySSh) {
+        options |= PINYIN_AMB_S_SH;
+    }
+    if (*fuzzy.fuzzyZZh) {
+        options |= PINYIN_AMB_Z_ZH;
+    }
+    if (*fuzzy.fuzzyFH) {
+        options |= PINYIN_AMB_F_H;
+    }
+    if (*fuzzy.fuzzyGK) {
+        options |= PINYIN_AMB_G_K;
+    }
+    if (*fuzzy.fuzzyLN) {
+        options |= PINYIN_AMB_L_N;
+    }
+    if (*fuzzy.fuzzyLR) {
+        options |= PINYIN_AMB_L_R;
+    }
+    if (*fuzzy.fuzzyAnAng) {
+        options |= PINYIN_AMB_AN_ANG;
+    }
+    if (*fuzzy.fuzzyEnEng) {
+        options |= PINYIN_AMB_EN_ENG;
+    }
+    if (*fuzzy.fuzzyInIng) {
+        options |= PINYIN_AMB_IN_ING;
+    }
+
+    result.options = options;
+    return result;
+}
+
+std::shared_ptr<const ZhuyinSymbol>
+loadSymbol(const std::filesystem::path &path) {
+    auto symbol = std::make_shared<ZhuyinSymbol>();
+    if (!path.empty()) {
+        UnixFD fd = UnixFD::own(open(path.c_str(), O_RDONLY));
+        if (fd.isValid()) {
+            IFDStreamBuf buf(std::move(fd));
+            std::istream in(&buf);
+            symbol->load(in);
+            return symbol;
+        }
+    }
+    symbol->reset();
+    return symbol;
+}
+
+} // namespace
 
 ZhuyinState::ZhuyinState(ZhuyinEngine *engine, InputContext *ic)
-    : engine_(engine), buffer_(engine), ic_(ic) {}
+    : engine_(engine), ic_(ic) {}
 
-void ZhuyinState::reset() {
+ZhuyinBuffer &ZhuyinState::buffer() {
+    if (!buffer_) {
+        buffer_ = std::make_unique<ZhuyinBuffer>(engine_);
+    }
+    return *buffer_;
+}
+
+bool ZhuyinState::releaseIfIdle(uint64_t now, uint64_t idle) {
+    if (!buffer_ || !buffer_->empty() || ic_->hasFocus() ||
+        now - lastActive_ < idle) {
+        return false;
+    }
+    buffer_.reset();
+    return true;
+}
+
+bool ZhuyinState::releaseBuffer() {
+    if (!isBufferEmpty()) {
+        return false;
+    }
+    candidateEvent_.reset();
+    candidateRequested_ = 0;
+    guessEvent_.reset();
     buffer_.reset();
+    return true;
+}
+
+void ZhuyinState::reset() {
+    if (buffer_) {
+        buffer_->reset();
+    }
     updateUI();
 }
 
 void ZhuyinState::commit() {
-    ic_->commitString(buffer_.text());
-    buffer_.learn();
+    ZhuyinWatchdog watchdog(engine_->watchdogThreshold());
+    if (buffer_) {
+        ic_->commitString(buffer_->text());
+        engine_->learn(*buffer_, profile_);
+        // Check before reset, so the committed buffer is reported.
+        if (watchdog.expired()) {
+            engine_->reportSlow("commit", watchdog, buffer_.get());
+        }
+    }
     reset();
 }
 
@@ -70,6 +185,10 @@ void ZhuyinState::keyEvent(KeyEvent &keyEvent) {
     if (keyEvent.isRelease()) {
         return;
     }
+    lastActive_ = now(CLOCK_MONOTONIC);
+    // The list requested by the previous key may not be shown yet, and this
+    // key may be meant for it.
+    showPendingCandidate();
 
     if (auto candidateList = ic->inputPanel().candidateList();
         candidateList && candidateList->size()) {
@@ -139,15 +258,15 @@ void ZhuyinState::keyEvent(KeyEvent &keyEvent) {
         return;
     }
 
-    if (!buffer_.empty()) {
+    if (!isBufferEmpty()) {
         if (key.check(FcitxKey_Home)) {
-            buffer_.moveCursorToBeginning();
+            buffer_->moveCursorToBeginning();
             updateUI();
             keyEvent.filterAndAccept();
             return;
         }
         if (key.check(FcitxKey_End)) {
-            buffer_.moveCursorToEnd();
+            buffer_->moveCursorToEnd();
             updateUI();
             keyEvent.filterAndAccept();
             return;
@@ -158,13 +277,13 @@ void ZhuyinState::keyEvent(KeyEvent &keyEvent) {
             return;
         }
         if (key.check(FcitxKey_BackSpace)) {
-            buffer_.backspace();
+            buffer_->backspace();
             updateUI();
             keyEvent.filterAndAccept();
             return;
         }
         if (key.check(FcitxKey_Delete)) {
-            buffer_.del();
+            buffer_->del();
             updateUI();
             keyEvent.filterAndAccept();
             return;
@@ -175,19 +294,19 @@ void ZhuyinState::keyEvent(KeyEvent &keyEvent) {
             return;
         }
         if (key.check(FcitxKey_Left)) {
-            buffer_.moveCursorLeft();
+            buffer_->moveCursorLeft();
             updateUI();
             keyEvent.filterAndAccept();
             return;
         }
         if (key.check(FcitxKey_Right)) {
-            buffer_.moveCursorRight();
+            buffer_->moveCursorRight();
             updateUI();
             keyEvent.filterAndAccept();
             return;
         }
         if (key.check(FcitxKey_Return, KeyState::Shift)) {
-            ic->commitString(buffer_.rawText());
+            ic->commitString(buffer_->rawText());
             reset();
             keyEvent.filterAndAccept();
             return;
@@ -204,7 +323,7 @@ void ZhuyinState::keyEvent(KeyEvent &keyEvent) {
     }
 
     auto c = Key::keySymToUnicode(key.sym());
-    if (buffer_.empty()) {
+    if (isBufferEmpty()) {
         if (key.check(*engine_->config().quickphraseKey) &&
             engine_->quickphrase()) {
             std::string keyString;
@@ -250,18 +369,17 @@ void ZhuyinState::keyEvent(KeyEvent &keyEvent) {
 
     if (c <= std::numeric_limits<signed char>::max() &&
         !charutils::isprint(c)) {
-        if (!buffer_.empty()) {
+        if (!isBufferEmpty()) {
             keyEvent.filterAndAccept();
         }
         return;
     }
 
     if (c) {
-        buffer_.type(c);
-        if (utf8::length(buffer_.preedit().toStringForCommit()) >
-            MAX_INPUT_LENGTH) {
-            ic->commitString(buffer_.text());
-            buffer_.learn();
+        buffer().type(c);
+        if (buffer_->preeditLength() > MAX_INPUT_LENGTH) {
+            ic->commitString(buffer_->text());
+            engine_->learn(*buffer_, profile_);
             reset();
         } else {
             updateUI();
@@ -271,34 +389,107 @@ void ZhuyinState::keyEvent(KeyEvent &keyEvent) {
 }
 
 void ZhuyinState::updateUI(bool showCandidate) {
+    ZhuyinPhaseTimer timer(ZhuyinPhase::UI);
+    // Any change to the buffer makes a pending candidate list stale.
+    revision_ += 1;
+    candidateEvent_.reset();
+    candidateRequested_ = 0;
+    guessEvent_.reset();
+
     ic_->inputPanel().reset();
-    Text preedit(buffer_.preedit());
+    updatePreedit();
+
+    if (buffer_ && buffer_->guessPending()) {
+        // Wait for one budget before guessing, keys typed within it reset
+        // the timer, so a burst of keys only pays for one guess. The guess
+        // still runs on the main loop, keys arriving during it wait.
+        guessEvent_ = engine_->instance()->eventLoop().addTimeEvent(
+            CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + engine_->guessBudget(), 0,
+            [this, revision = revision_](EventSourceTime *, uint64_t) {
+                if (revision != revision_ || !buffer_) {
+                    return true;
+                }
+                engine_->applyProfile(profile_);
+                ZhuyinArenaScope arena;
+                ZhuyinWatchdog watchdog(engine_->watchdogThreshold());
+                buffer_->finishGuess();
+                updatePreedit();
+                ic_->updateUserInterface(UserInterfaceComponent::InputPanel);
+                if (watchdog.expired()) {
+                    engine_->reportSlow("guess", watchdog, buffer_.get());
+                }
+                return true;
+            });
+    }
+
+    if (showCandidate && buffer_) {
+        // Building the list queries libzhuyin for every candidate, which can
+        // be slow with a large user dictionary. It still runs on the main
+        // loop, since candidates point into the buffer, but after the key
+        // handler returns, so the key itself is answered first. A key that
+        // arrives before the list is built builds it first.
+        candidateRequested_ = now(CLOCK_MONOTONIC);
+        candidateEvent_ = engine_->instance()->eventLoop().addTimeEvent(
+            CLOCK_MONOTONIC, candidateRequested_, 0,
+            [this](EventSourceTime *, uint64_t) {
+                showPendingCandidate();
+                return true;
+            });
+    }
+
+    ic_->updateUserInterface(UserInterfaceComponent::InputPanel);
+}
+
+void ZhuyinState::updatePreedit() {
+    Text preedit = buffer_ ? buffer_->preedit() : Text();
     if (ic_->capabilityFlags().test(CapabilityFlag::Preedit)) {
         ic_->inputPanel().setClientPreedit(preedit);
         ic_->updatePreedit();
     } else {
         ic_->inputPanel().setPreedit(preedit);
     }
+}
 
-    if (showCandidate) {
-        auto candidateList = std::make_unique<CommonCandidateList>();
-        candidateList->setCursorPositionAfterPaging(
-            CursorPositionAfterPaging::SameAsLast);
-        candidateList->setLayoutHint(CandidateLayoutHint::Vertical);
-        candidateList->setPageSize(*engine_->config().pageSize);
-        candidateList->setSelectionKey(engine_->selectionKeys());
-        buffer_.showCandidate(
-            [this, &candidateList](std::unique_ptr<ZhuyinCandidate> candidate) {
-                candidate->connect<ZhuyinCandidate::selected>(
-                    [this]() { updateUI(); });
-                candidateList->append(std::move(candidate));
-            });
-        if (candidateList->size()) {
-            candidateList->setGlobalCursorIndex(0);
-            ic_->inputPanel().setCandidateList(std::move(candidateList));
-        }
+void ZhuyinState::showPendingCandidate() {
+    if (!candidateRequested_) {
+        return;
+    }
+    const auto requested = candidateRequested_;
+    candidateRequested_ = 0;
+    engine_->applyProfile(profile_);
+    ZhuyinArenaScope arena;
+    ZhuyinWatchdog watchdog(engine_->watchdogThreshold());
+    updateCandidate();
+    ZHUYIN_DEBUG() << "Candidate list shown "
+                   << now(CLOCK_MONOTONIC) - requested
+                   << "us after it is requested.";
+    if (watchdog.expired()) {
+        engine_->reportSlow("candidate", watchdog, buffer_.get());
     }
+}
 
+void ZhuyinState::updateCandidate() {
+    if (!buffer_) {
+        return;
+    }
+    ZhuyinPhaseTimer timer(ZhuyinPhase::Candidate);
+    auto candidateList = std::make_unique<CommonCandidateList>();
+    candidateList->setCursorPositionAfterPaging(
+        CursorPositionAfterPaging::SameAsLast);
+    candidateList->setLayoutHint(CandidateLayoutHint::Vertical);
+    candidateList->setPageSize(*engine_->config().pageSize);
+    candidateList->setSelectionKey(engine_->selectionKeys());
+    buffer_->showCandidate(
+        [this, &candidateList](std::unique_ptr<ZhuyinCandidate> candidate) {
+            candidate->connect<ZhuyinCandidate::selected>(
+                [this]() { updateUI(); });
+            candidateList->append(std::move(candidate));
+        });
+    if (!candidateList->size()) {
+        return;
+    }
+    candidateList->setGlobalCursorIndex(0);
+    ic_->inputPanel().setCandidateList(std::move(candidateList));
     ic_->updateUserInterface(UserInterfaceComponent::InputPanel);
 }
 
@@ -307,23 +498,69 @@ ZhuyinEngine::ZhuyinEngine(Instance *instance)
           return new ZhuyinState(this, &ic);
       }) {
     const auto &sp = StandardPaths::global();
-    auto userDir = sp.userDirectory(StandardPathsType::PkgData) / "zhuyin";
-    if (!fs::makePath(userDir)) {
-        if (fs::isdir(userDir)) {
-            ZHUYIN_DEBUG() << "Failed to create user directory: " << userDir;
+    userDir_ = sp.userDirectory(StandardPathsType::PkgData) / "zhuyin";
+    if (!fs::makePath(userDir_)) {
+        if (fs::isdir(userDir_)) {
+            ZHUYIN_DEBUG() << "Failed to create user directory: " << userDir_;
         }
     }
     std::string tablePath =
         sp.locate(StandardPathsType::PkgData, "zhuyin/table.conf");
-    context_.reset(zhuyin_init(fcitx::fs::dirName(tablePath).c_str(),
-                               userDir.string().c_str()));
+    systemDir_ = fcitx::fs::dirName(tablePath);
+    context_.reset(
+        zhuyin_init(systemDir_.string().c_str(), userDir_.string().c_str()));
 
+    dispatcher_.attach(&instance->eventLoop());
     instance->inputContextManager().registerProperty("zhuyinState", &factory_);
     reloadConfig();
+    // Left by a compaction that did not finish before fcitx exited.
+    untrained_ = loadUntrained(userDir_.string());
+    trainUntrained();
+
+    if (auto *quickphrase = this->quickphrase()) {
+        symbolProvider_ = quickphrase->call<IQuickPhrase::addProvider>(
+            [this](InputContext *ic, const std::string &text,
+                   const QuickPhraseAddCandidateCallback &addCandidate) {
+                return provideSymbol(ic, text, addCandidate);
+            });
+    }
+}
+
+std::vector<InputMethodEntry> ZhuyinEngine::listInputMethods() {
+    std::vector<InputMethodEntry> result;
+    for (const auto &profile : *config_.profiles) {
+        if (profile.name->empty()) {
+            continue;
+        }
+        result.emplace_back("zhuyin-" + *profile.name, *profile.name, "zh_TW",
+                            "zhuyin");
+        result.back()
+            .setIcon("fcitx-bopomofo")
+            .setLabel("ㄓ")
+            .setConfigurable(true);
+    }
+    return result;
 }
 
-void ZhuyinEngine::activate(const InputMethodEntry & /*entry*/,
+void ZhuyinEngine::applyProfile(const std::string &uniqueName) {
+    const auto *options = &contextOptions_;
+    if (auto iter = profiles_.find(uniqueName); iter != profiles_.end()) {
+        options = &iter->second;
+    }
+    appliedProfile_ = uniqueName;
+    if (*options == appliedOptions_) {
+        return;
+    }
+    // Only a few fields of the context are set, the model is untouched.
+    options->apply(context_.get());
+    appliedOptions_ = *options;
+    isZhuyin_ = options->isZhuyin;
+}
+
+void ZhuyinEngine::activate(const InputMethodEntry &entry,
                             InputContextEvent &event) {
+    applyProfile(entry.uniqueName());
+    checkSymbolUpdate();
     auto *inputContext = event.inputContext();
     // Request full width.
     fullwidth();
@@ -348,10 +585,18 @@ void ZhuyinEngine::deactivate(const InputMethodEntry &entry,
     reset(entry, event);
 }
 
-void ZhuyinEngine::keyEvent(const InputMethodEntry & /*entry*/,
+void ZhuyinEngine::keyEvent(const InputMethodEntry &entry,
                             KeyEvent &keyEvent) {
     auto *state = keyEvent.inputContext()->propertyFor(&factory_);
+    applyProfile(entry.uniqueName());
+    state->setProfile(entry.uniqueName());
+    // Temporaries of this key are released together once it is handled.
+    ZhuyinArenaScope arena;
+    ZhuyinWatchdog watchdog(watchdogThreshold());
     state->keyEvent(keyEvent);
+    if (watchdog.expired()) {
+        reportSlow("keyEvent", watchdog, state->bufferIfExists());
+    }
 }
 
 void ZhuyinEngine::reset(const InputMethodEntry & /*entry*/,
@@ -360,7 +605,101 @@ void ZhuyinEngine::reset(const InputMethodEntry & /*entry*/,
     state->reset();
 }
 
-void ZhuyinEngine::save() { zhuyin_save(context_.get()); }
+void ZhuyinEngine::save() {
+    if (compacting_) {
+        // Would overwrite the compacted files with the old dictionary.
+        ZHUYIN_DEBUG() << "Skip save during user dictionary compaction.";
+        return;
+    }
+    ZhuyinWatchdog watchdog(watchdogThreshold());
+    zhuyin_save(context_.get());
+    if (watchdog.expired()) {
+        reportSlow("save", watchdog, nullptr);
+    }
+
+    // If the policy keeps more than the limit, wait until it doubles before
+    // trying again.
+    const int64_t limit = *config_.userDictionary->sizeLimit * 1024LL;
+    const auto size = userDictionarySize(userDir_.string());
+    if (limit > 0 && size > limit && size > compactedSize_ * 2) {
+        compactUserDictionary();
+    }
+}
+
+void ZhuyinEngine::setSubConfig(const std::string &path,
+                                const RawConfig & /*unused*/) {
+    if (path == "compactuserdict") {
+        compactUserDictionary();
+    }
+}
+
+void ZhuyinEngine::compactUserDictionary() {
+    if (compacting_) {
+        return;
+    }
+    // Include everything learned so far.
+    zhuyin_save(context_.get());
+    compacting_ = true;
+    ZhuyinCompactPolicy policy;
+    policy.minCount = *config_.userDictionary->minCount;
+    policy.maxPhrases = *config_.userDictionary->maxPhrases;
+    compactor_ = std::async(
+        std::launch::async, [this, systemDir = systemDir_.string(),
+                             userDir = userDir_.string(), policy]() {
+            auto result = std::make_shared<ZhuyinCompactResult>(
+                fcitx::compactUserDictionary(systemDir, userDir, policy));
+            dispatcher_.schedule([this, result]() {
+                ZHUYIN_INFO() << "Compacted user dictionary, "
+                              << result->toString();
+                if (!result->success) {
+                    compacting_ = false;
+                    trainUntrained();
+                    return;
+                }
+                compactedSize_ = result->sizeAfter;
+                compactResult_ = result;
+                if (replaceContext()) {
+                    return;
+                }
+                // Retry until nothing is being typed.
+                replaceContextTimer_ = instance_->eventLoop().addTimeEvent(
+                    CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + 1000000, 0,
+                    [this](EventSourceTime *source, uint64_t /*usec*/) {
+                        if (!replaceContext()) {
+                            source->setNextInterval(1000000);
+                            source->setOneShot();
+                        }
+                        return true;
+                    });
+            });
+        });
+}
+
+bool ZhuyinEngine::replaceContext() {
+    bool busy = false;
+    instance_->inputContextManager().foreach(
+        [this, &busy](InputContext *ic) {
+            auto *state = ic->propertyFor(&factory_);
+            if (!state->releaseBuffer()) {
+                busy = true;
+            }
+            return true;
+        });
+    if (busy) {
+        return false;
+    }
+    // Nothing holds an instance of the old context from here.
+    queryBuffer_.reset();
+    context_ = std::move(compactResult_->context);
+    compactResult_.reset();
+    contextOptions_.apply(context_.get());
+    appliedOptions_ = contextOptions_;
+    appliedProfile_ = "zhuyin";
+    isZhuyin_ = contextOptions_.isZhuyin;
+    compacting_ = false;
+    trainUntrained();
+    return true;
+}
 void ZhuyinEngine::setConfig(const RawConfig &rawConfig) {
     config_.load(rawConfig, true);
     safeSaveAsIni(config_, "conf/zhuyin.conf");
@@ -368,67 +707,264 @@ void ZhuyinEngine::setConfig(const RawConfig &rawConfig) {
 }
 const Configuration *ZhuyinEngine::getConfig() const { return &config_; }
 
+void ZhuyinEngine::releaseIdleStates() {
+    const uint64_t idle = *config_.releaseIdleTime * 60ULL * 1000000ULL;
+    const auto current = now(CLOCK_MONOTONIC);
+    size_t released = 0;
+    size_t live = 0;
+    instance_->inputContextManager().foreach(
+        [this, current, idle, &released, &live](InputContext *ic) {
+            auto *state = ic->propertyFor(&factory_);
+            if (state->releaseIfIdle(current, idle)) {
+                released += 1;
+            } else if (state->hasBuffer()) {
+                live += 1;
+            }
+            return true;
+        });
+    ZHUYIN_DEBUG() << "Released " << released << " idle input states, "
+                   << live << " input states still hold a buffer.";
+}
+
+ZhuyinBuffer &ZhuyinEngine::queryBuffer(const std::string &keys) {
+    // Public API always uses the default input method.
+    applyProfile("zhuyin");
+    if (!queryBuffer_) {
+        queryBuffer_ = std::make_unique<ZhuyinBuffer>(this);
+    }
+    queryBuffer_->reset();
+    if (utf8::validate(keys)) {
+        for (auto c : utf8::MakeUTF8CharRange(keys)) {
+            queryBuffer_->type(c);
+        }
+    }
+    return *queryBuffer_;
+}
+
+std::string ZhuyinEngine::convert(const std::string &keys) {
+    auto &buffer = queryBuffer(keys);
+    auto result = buffer.text();
+    buffer.reset();
+    return result;
+}
+
+void ZhuyinEngine::convertAsync(
+    const std::string &keys,
+    std::function<void(const std::string &)> callback) {
+    convertQueue_.emplace_back(keys, std::move(callback));
+    if (convertQueue_.size() > 1) {
+        return;
+    }
+    // zhuyin_context_t can only be used by one thread, and another copy of
+    // the model costs as much memory as the first, so requests are
+    // converted on the main loop with the loaded one. One request per
+    // iteration, so keys of input contexts are handled in between.
+    if (convertTimer_) {
+        convertTimer_->setTime(now(CLOCK_MONOTONIC));
+        convertTimer_->setOneShot();
+        return;
+    }
+    convertTimer_ = instance_->eventLoop().addTimeEvent(
+        CLOCK_MONOTONIC, now(CLOCK_MONOTONIC), 0,
+        [this](EventSourceTime *source, uint64_t /*usec*/) {
+            auto [keys, callback] = std::move(convertQueue_.front());
+            convertQueue_.pop_front();
+            if (!convertQueue_.empty()) {
+                source->setNextInterval(0);
+                source->setOneShot();
+            }
+            callback(convert(keys));
+            return true;
+        });
+}
+
+void ZhuyinEngine::reportSlow(const char *operation,
+                              const ZhuyinWatchdog &watchdog,
+                              const ZhuyinBuffer *buffer) const {
+    auto layout = *config_.layout;
+    for (const auto &profile : *config_.profiles) {
+        if (appliedProfile_ == "zhuyin-" + *profile.name) {
+            layout = *profile.layout;
+            break;
+        }
+    }
+    // Only the shape of the buffer is logged, never the text user typed.
+    ZHUYIN_WARN() << "Slow " << operation << ": " << watchdog.elapsed()
+                  << "us, " << watchdog.phases()
+                  << ", profile: " << appliedProfile_
+                  << ", layout: " << SchemeToString(layout)
+                  << ", options: " << appliedOptions_.options << ", buffer: "
+                  << (buffer ? buffer->dumpShape() : std::string("none"));
+}
+
+std::vector<std::string> ZhuyinEngine::candidates(const std::string &keys,
+                                                  size_t n) {
+    std::vector<std::string> result;
+    auto &buffer = queryBuffer(keys);
+    buffer.moveCursorToBeginning();
+    buffer.showCandidate(
+        [&result, n](std::unique_ptr<ZhuyinCandidate> candidate) {
+            if (result.size() < n) {
+                result.push_back(candidate->text().toString());
+            }
+        });
+    buffer.reset();
+    return result;
+}
+
+bool ZhuyinEngine::provideSymbol(
+    InputContext *ic, const std::string &text,
+    const QuickPhraseAddCandidateCallback &addCandidate) {
+    constexpr std::string_view command = "sy";
+    if (!stringutils::startsWith(instance_->inputMethod(ic), "zhuyin") ||
+        !stringutils::startsWith(text, command)) {
+        return true;
+    }
+    auto key = std::string_view(text).substr(command.size());
+    if (key.empty()) {
+        for (const auto *symbol : {"…", "※"}) {
+            addCandidate(symbol, symbol, QuickPhraseAction::Commit);
+        }
+        for (size_t i = 0; i < ZhuyinSymbol::categoryCount(); i++) {
+            const auto &category = ZhuyinSymbol::category(i);
+            addCandidate(stringutils::concat(text, category.key),
+                         stringutils::concat(category.key, " ",
+                                             category.description),
+                         QuickPhraseAction::TypeToBuffer);
+        }
+    } else if (const auto *category = ZhuyinSymbol::findCategory(key)) {
+        for (const auto *symbol = category->symbols; *symbol; ++symbol) {
+            addCandidate(*symbol, *symbol, QuickPhraseAction::Commit);
+        }
+    } else {
+        // Called again on every key, so only the first page or so of
+        // matches is needed.
+        constexpr size_t maxMatches = 100;
+        size_t matches = 0;
+        symbol_->search(key, [&addCandidate, &matches](
+                                 const std::string &key,
+                                 const std::string &symbol) {
+            addCandidate(symbol, stringutils::concat(symbol, " ", key),
+                         QuickPhraseAction::Commit);
+            return ++matches < maxMatches;
+        });
+    }
+    return true;
+}
+
+void ZhuyinEngine::learn(ZhuyinBuffer &buffer, const std::string &profile) {
+    if (!compacting_) {
+        buffer.learn();
+        return;
+    }
+    auto sentences = buffer.sentences();
+    if (!appendUntrained(userDir_.string(), profile, sentences)) {
+        ZHUYIN_WARN() << "Failed to keep commit in " << userDir_
+                      << ", it is lost if fcitx exits before compaction is "
+                         "done.";
+    }
+    untrained_.emplace_back(profile, std::move(sentences));
+}
+
+void ZhuyinEngine::trainUntrained() {
+    if (untrained_.empty()) {
+        removeUntrained(userDir_.string());
+        return;
+    }
+    ZhuyinBuffer buffer(this);
+    for (const auto &[profile, sentences] : untrained_) {
+        applyProfile(profile);
+        buffer.learn(sentences);
+    }
+    ZHUYIN_DEBUG() << "Learned " << untrained_.size()
+                   << " commits made during compaction.";
+    untrained_.clear();
+    // Only drop the file once they are in user dictionary.
+    save();
+    removeUntrained(userDir_.string());
+}
+
+void ZhuyinEngine::checkSymbolUpdate() {
+    // Activate happens on every focus change, while the file is only edited
+    // by hand once in a while.
+    constexpr uint64_t symbolCheckInterval = 30 * 1000000ULL;
+    if (!*config_.useEasySymbol || symbolLoading_) {
+        return;
+    }
+    const auto current = now(CLOCK_MONOTONIC);
+    if (symbolChecked_ && current - symbolChecked_ < symbolCheckInterval) {
+        return;
+    }
+    symbolChecked_ = current;
+    auto path = StandardPaths::global().locate(StandardPathsType::PkgData,
+                                               "zhuyin/easysymbols.txt");
+    int64_t timestamp = path.empty() ? 0 : fs::modifiedTime(path);
+    if (path == symbolPath_ && timestamp == symbolTimestamp_) {
+        return;
+    }
+    ZHUYIN_DEBUG() << "Reload symbol file: " << path;
+    symbolPath_ = path;
+    symbolTimestamp_ = timestamp;
+    loadSymbolInBackground();
+}
+
+void ZhuyinEngine::loadSymbolInBackground() {
+    if (symbolLoading_) {
+        // Started again once the running load finishes.
+        return;
+    }
+    symbolLoading_ = true;
+    // Existing sections and candidates own a copy of their symbol, so the
+    // table can be swapped at any time on the main thread.
+    symbolLoader_ = std::async(
+        std::launch::async,
+        [this, path = symbolPath_, timestamp = symbolTimestamp_]() {
+            auto symbol = loadSymbol(path);
+            dispatcher_.schedule([this, path, timestamp, symbol]() {
+                symbolLoading_ = false;
+                if (path != symbolPath_ || timestamp != symbolTimestamp_) {
+                    if (!symbolPath_.empty()) {
+                        loadSymbolInBackground();
+                    }
+                    return;
+                }
+                symbol_ = symbol;
+            });
+        });
+}
+
 void ZhuyinEngine::reloadConfig() {
     readAsIni(config_, "conf/zhuyin.conf");
-    symbol_.reset();
+    symbolPath_.clear();
+    symbolTimestamp_ = 0;
     if (*config_.useEasySymbol) {
-        UnixFD fd = StandardPaths::global().open(StandardPathsType::PkgData,
-                                                 "zhuyin/easysymbols.txt");
-        if (fd.isValid()) {
-            IFDStreamBuf buf(std::move(fd));
-            std::istream in(&buf);
-            symbol_.load(in);
-        }
-    }
-
-    isZhuyin_ = true;
-    ZhuyinScheme scheme = ZHUYIN_STANDARD;
-    FullPinyinScheme pyScheme = FULL_PINYIN_HANYU;
-    switch (*config_.layout) {
-    case Scheme::Standard:
-        scheme = ZHUYIN_STANDARD;
-        break;
-    case Scheme::Hsu:
-        scheme = ZHUYIN_HSU;
-        break;
-    case Scheme::IBM:
-        scheme = ZHUYIN_IBM;
-        break;
-    case Scheme::GinYieh:
-        scheme = ZHUYIN_GINYIEH;
-        break;
-    case Scheme::Eten:
-        scheme = ZHUYIN_ETEN;
-        break;
-    case Scheme::Eten26:
-        scheme = ZHUYIN_ETEN26;
-        break;
-    case Scheme::Dvorak:
-        scheme = ZHUYIN_STANDARD_DVORAK;
-        break;
-    case Scheme::HsuDvorak:
-        scheme = ZHUYIN_HSU_DVORAK;
-        break;
-    case Scheme::DachenCP26:
-        scheme = ZHUYIN_DACHEN_CP26;
-        break;
-    case Scheme::Hanyu:
-        pyScheme = FULL_PINYIN_HANYU;
-        isZhuyin_ = false;
-        break;
-    case Scheme::Luoma:
-        pyScheme = FULL_PINYIN_LUOMA;
-        isZhuyin_ = false;
-        break;
-    case Scheme::SecondaryZhuyin:
-        pyScheme = FULL_PINYIN_SECONDARY_ZHUYIN;
-        isZhuyin_ = false;
-        break;
-    }
-    if (isZhuyin_) {
-        zhuyin_set_chewing_scheme(context_.get(), scheme);
-    } else {
-        zhuyin_set_full_pinyin_scheme(context_.get(), pyScheme);
+        symbolPath_ = StandardPaths::global().locate(
+            StandardPathsType::PkgData, "zhuyin/easysymbols.txt");
+        if (!symbolPath_.empty()) {
+            symbolTimestamp_ = fs::modifiedTime(symbolPath_);
+        }
+    }
+    // Builtin symbols are ready right away, easysymbols.txt replaces them
+    // once it is loaded in background.
+    if (!symbol_ || symbolPath_.empty()) {
+        symbol_ = loadSymbol({});
+    }
+    if (!symbolPath_.empty()) {
+        loadSymbolInBackground();
+    }
+    symbolChecked_ = now(CLOCK_MONOTONIC);
+
+    contextOptions_ = contextOptionsFor(*config_.layout, *config_.needTone,
+                                        *config_.fuzzy);
+    profiles_.clear();
+    for (const auto &profile : *config_.profiles) {
+        if (profile.name->empty()) {
+            continue;
+        }
+        profiles_.emplace(
+            "zhuyin-" + *profile.name,
+            contextOptionsFor(*profile.layout, *profile.needTone,
+                              *profile.fuzzy));
     }
 
     constexpr KeySym syms[][10] = {
@@ -516,48 +1052,32 @@ void ZhuyinEngine::reloadConfig() {
         selectionKeys_.emplace_back(sym, states);
     }
 
-    pinyin_option_t options = USE_TONE | ZHUYIN_CORRECT_ALL;
-    if (isZhuyin_ && *config_.needTone) {
-        options |= FORCE_TONE;
-    }
-    if (*config_.fuzzy->fuzzyCCh) {
-        options |= PINYIN_AMB_C_CH;
-    }
-    if (*config_.fuzzy->fuzzySSh) {
-        options |= PINYIN_AMB_S_SH;
-    }
-    if (*config_.fuzzy->fuzzyZZh) {
-        options |= PINYIN_AMB_Z_ZH;
-    }
-    if (*config_.fuzzy->fuzzyFH) {
-        options |= PINYIN_AMB_F_H;
-    }
-    if (*config_.fuzzy->fuzzyGK) {
-        options |= PINYIN_AMB_G_K;
-    }
-    if (*config_.fuzzy->fuzzyLN) {
-        options |= PINYIN_AMB_L_N;
-    }
-    if (*config_.fuzzy->fuzzyLR) {
-        options |= PINYIN_AMB_L_R;
-    }
-    if (*config_.fuzzy->fuzzyAnAng) {
-        options |= PINYIN_AMB_AN_ANG;
-    }
-    if (*config_.fuzzy->fuzzyEnEng) {
-        options |= PINYIN_AMB_EN_ENG;
-    }
-    if (*config_.fuzzy->fuzzyInIng) {
-        options |= PINYIN_AMB_IN_ING;
-    }
+    contextOptions_.apply(context_.get());
+    appliedOptions_ = contextOptions_;
+    appliedProfile_ = "zhuyin";
+    isZhuyin_ = contextOptions_.isZhuyin;
 
-    zhuyin_set_options(context_.get(), options);
+    releaseTimer_.reset();
+    if (*config_.releaseIdleTime > 0) {
+        // A quarter of the idle time, see releaseIdleStates.
+        const uint64_t interval =
+            *config_.releaseIdleTime * 60ULL * 1000000ULL / 4;
+        releaseTimer_ = instance_->eventLoop().addTimeEvent(
+            CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + interval, 0,
+            [this, interval](EventSourceTime *source, uint64_t /*usec*/) {
+                releaseIdleStates();
+                source->setNextInterval(interval);
+                source->setOneShot();
+                return true;
+            });
+    }
 
     instance_->inputContextManager().foreach([this](InputContext *ic) {
         auto *state = ic->propertyFor(&factory_);
         state->reset();
         return true;
     });
+    queryBuffer_.reset();
 
     zhuyin_load_phrase_library(context_.get(), USER_DICTIONARY);
 }
@@ -7,12 +7,22 @@
 #ifndef _FCITX5_ZHUYIN_ZHUYINENGINE_H_
 #define _FCITX5_ZHUYIN_ZHUYINENGINE_H_
 
+#include "zhuyin_public.h"
 #include "zhuyinbuffer.h"
+#include "zhuyinoptions.h"
 #include "zhuyinsymbol.h"
+#include "zhuyinuserdict.h"
+#include "zhuyinwatchdog.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <fcitx-config/configuration.h>
 #include <fcitx-config/enum.h>
 #include <fcitx-config/option.h>
 #include <fcitx-config/rawconfig.h>
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/handlertable.h>
 #include <fcitx-utils/i18n.h>
 #include <fcitx-utils/inputbuffer.h>
 #include <fcitx-utils/key.h>
@@ -24,10 +34,18 @@
 #include <fcitx/event.h>
 #include <fcitx/inputcontextproperty.h>
 #include <fcitx/inputmethodengine.h>
+#include <fcitx/inputmethodentry.h>
 #include <fcitx/instance.h>
 #include <fcitx/text.h>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
 #include <quickphrase_public.h>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <zhuyin.h>
 
 namespace fcitx {
@@ -78,6 +96,28 @@ FCITX_CONFIGURATION(
     Option<bool> fuzzyEnEng{this, "FuzzyEnEng", "ㄧㄣ <=> ㄧㄥ", false};
     Option<bool> fuzzyInIng{this, "FuzzyInIng", "ㄣ <=> ㄥ", false};);
 
+FCITX_CONFIGURATION(
+    ProfileConfig, Option<std::string> name{this, "Name", _("Name"), ""};
+    OptionWithAnnotation<Scheme, SchemeI18NAnnotation> layout{
+        this, "Layout", _("Layout"), Scheme::Standard};
+    Option<bool> needTone{this, "NeedTone", _("Require tone in zhuyin"), true};
+    Option<FuzzyConfig> fuzzy{this, "Fuzzy", _("Fuzzy")};);
+
+FCITX_CONFIGURATION(
+    UserDictionaryConfig,
+    Option<int, IntConstrain> sizeLimit{
+        this, "SizeLimit",
+        _("Compact automatically when larger than KB (0 to disable)"), 0,
+        IntConstrain(0, 1024 * 1024)};
+    Option<int, IntConstrain> minCount{
+        this, "MinCount", _("Drop phrases used fewer times than"), 1,
+        IntConstrain(1, 1000)};
+    Option<int, IntConstrain> maxPhrases{this, "MaxPhrases",
+                                         _("Maximum number of learned phrases"),
+                                         20000, IntConstrain(100, 1000000)};
+    ExternalOption compact{this, "Compact", _("Compact user dictionary now"),
+                           "fcitx://config/addon/zhuyin/compactuserdict"};);
+
 FCITX_CONFIGURATION(
     ZhuyinConfig,
     OptionWithAnnotation<Scheme, SchemeI18NAnnotation> layout{
@@ -91,6 +131,19 @@ FCITX_CONFIGURATION(
     Option<int, IntConstrain> pageSize{this, "PageSize", _("Page size"), 10,
                                        IntConstrain(3, 10)};
     Option<bool> useEasySymbol{this, "EasySymbol", _("Use easy symbol"), true};
+    Option<int, IntConstrain> releaseIdleTime{
+        this, "ReleaseIdleTime",
+        _("Release unused input state after idle minutes (0 to disable)"), 30,
+        IntConstrain(0, 1440)};
+    Option<int, IntConstrain> slowOperationThreshold{
+        this, "SlowOperationThreshold",
+        _("Log key handling slower than milliseconds (0 to disable)"), 100,
+        IntConstrain(0, 10000)};
+    Option<int, IntConstrain> guessBudget{
+        this, "GuessBudget",
+        _("Show input as is when conversion is slower than milliseconds, "
+          "and convert after the key (0 to disable)"),
+        0, IntConstrain(0, 10000)};
     Option<Key, KeyConstrain> quickphraseKey{
         this, "QuickPhraseKey", _("QuickPhrase Trigger Key"),
         Key(FcitxKey_grave), KeyConstrain{KeyConstrainFlag::AllowModifierLess}};
@@ -120,7 +173,13 @@ FCITX_CONFIGURATION(
         _("Next Candidate"),
         {Key("Down"), Key("Tab")},
         KeyListConstrain({KeyConstrainFlag::AllowModifierLess})};
-    Option<FuzzyConfig> fuzzy{this, "Fuzzy", _("Fuzzy")};);
+    Option<FuzzyConfig> fuzzy{this, "Fuzzy", _("Fuzzy")};
+    Option<UserDictionaryConfig> userDictionary{this, "UserDictionary",
+                                                _("User Dictionary")};
+    // Every profile is listed as another input method, which shares the
+    // model and user dictionary with the default one.
+    Option<std::vector<ProfileConfig>> profiles{
+        this, "Profiles", _("Additional layout profiles")};);
 
 class ZhuyinEngine;
 
@@ -132,12 +191,43 @@ public:
     void reset();
     void commit();
 
+    // Candidate list is built asynchronously when showCandidate is true.
     void updateUI(bool showCandidate = false);
 
+    bool hasBuffer() const { return buffer_ != nullptr; }
+    const ZhuyinBuffer *bufferIfExists() const { return buffer_.get(); }
+    // Free the buffer if it is empty, so the context can be replaced.
+    bool releaseBuffer();
+    // Unique name of the input method that typed into the buffer.
+    void setProfile(const std::string &profile) { profile_ = profile; }
+    // Free the buffer if it is empty, unfocused and unused for idle usec.
+    bool releaseIfIdle(uint64_t now, uint64_t idle);
+
 private:
+    // Most input contexts never type any zhuyin, so the buffer and its
+    // zhuyin instance are only allocated on the first key that needs them.
+    ZhuyinBuffer &buffer();
+    bool isBufferEmpty() const { return !buffer_ || buffer_->empty(); }
+    // Build the candidate list requested by the last UI update, if it is
+    // not built yet.
+    void showPendingCandidate();
+    void updateCandidate();
+    void updatePreedit();
+
     ZhuyinEngine *engine_;
-    ZhuyinBuffer buffer_;
+    std::unique_ptr<ZhuyinBuffer> buffer_;
     InputContext *ic_;
+    uint64_t lastActive_ = 0;
+    // Bumped on every UI update, a deferred guess for an older revision is
+    // dropped.
+    uint64_t revision_ = 0;
+    // When the pending candidate list is requested, 0 if there is none.
+    uint64_t candidateRequested_ = 0;
+    std::unique_ptr<EventSource> candidateEvent_;
+    // Finish the sentence guess deferred by the guess budget, after a delay
+    // of one budget.
+    std::unique_ptr<EventSource> guessEvent_;
+    std::string profile_ = "zhuyin";
 };
 
 class ZhuyinEngine : public InputMethodEngine, public ZhuyinProviderInterface {
@@ -156,26 +246,124 @@ public:
     void setConfig(const fcitx::RawConfig & /*unused*/) override;
     void save() override;
     void reloadConfig() override;
+    void setSubConfig(const std::string &path,
+                      const fcitx::RawConfig & /*unused*/) override;
+
+    std::vector<InputMethodEntry> listInputMethods() override;
+
+    // Set the options of the input method on the shared context, does
+    // nothing if they are already set.
+    void applyProfile(const std::string &uniqueName);
 
     zhuyin_context_t *context() override { return context_.get(); }
     bool isZhuyin() const override { return isZhuyin_; }
+    uint64_t guessBudget() const override {
+        return static_cast<uint64_t>(*config_.guessBudget) * 1000;
+    }
     const auto &config() const { return config_; }
-    const ZhuyinSymbol &symbol() const override { return symbol_; }
+    Instance *instance() const { return instance_; }
+    const ZhuyinSymbol &symbol() const override { return *symbol_; }
 
     const KeyList &selectionKeys() const { return selectionKeys_; }
 
+    // Threshold of ZhuyinWatchdog in usec.
+    uint64_t watchdogThreshold() const {
+        return static_cast<uint64_t>(*config_.slowOperationThreshold) * 1000;
+    }
+    // Log a slow operation, buffer may be nullptr.
+    void reportSlow(const char *operation, const ZhuyinWatchdog &watchdog,
+                    const ZhuyinBuffer *buffer) const;
+
+    // Train the model with what is committed from buffer by the input method
+    // profile.
+    void learn(ZhuyinBuffer &buffer, const std::string &profile);
+
+    std::string convert(const std::string &keys);
+    void convertAsync(const std::string &keys,
+                      std::function<void(const std::string &)> callback);
+    std::vector<std::string> candidates(const std::string &keys, size_t n);
+
     FCITX_ADDON_DEPENDENCY_LOADER(fullwidth, instance_->addonManager());
     FCITX_ADDON_DEPENDENCY_LOADER(chttrans, instance_->addonManager());
     FCITX_ADDON_DEPENDENCY_LOADER(quickphrase, instance_->addonManager());
 
 private:
+    FCITX_ADDON_EXPORT_FUNCTION(ZhuyinEngine, convert);
+    FCITX_ADDON_EXPORT_FUNCTION(ZhuyinEngine, convertAsync);
+    FCITX_ADDON_EXPORT_FUNCTION(ZhuyinEngine, candidates);
+
+    // Type keys into the shared query buffer.
+    ZhuyinBuffer &queryBuffer(const std::string &keys);
+    // Provide symbol categories for "sy" in QuickPhrase.
+    bool provideSymbol(InputContext *ic, const std::string &text,
+                       const QuickPhraseAddCandidateCallback &addCandidate);
+    // Reload easysymbols.txt in background if it is changed on disk, checked
+    // at most once every 30 seconds.
+    void checkSymbolUpdate();
+    // Load symbolPath_ on a worker thread and publish it on the main thread,
+    // unless the path or its timestamp changed meanwhile.
+    void loadSymbolInBackground();
+    // Release the buffer of input states idle for ReleaseIdleTime. It runs
+    // every quarter of ReleaseIdleTime, so an idle buffer lives for up to
+    // 1.25 times of it, without a timer per input context.
+    void releaseIdleStates();
+    // Rewrite user dictionary in background, see compactUserDictionary.
+    void compactUserDictionary();
+    // Replace context_ with the one loaded from compacted files, fails if
+    // any input context is still typing.
+    bool replaceContext();
+    // Train what is committed during compaction into context_, save it and
+    // remove the untrained file.
+    void trainUntrained();
+
     Instance *instance_;
+    std::filesystem::path systemDir_;
+    std::filesystem::path userDir_;
     UniqueCPtr<zhuyin_context_t, zhuyin_fini> context_;
     FactoryFor<ZhuyinState> factory_;
-    ZhuyinSymbol symbol_;
+    // Symbol table is immutable once published, a reload always builds a new
+    // one and swap it on the main thread.
+    std::shared_ptr<const ZhuyinSymbol> symbol_;
+    std::filesystem::path symbolPath_;
+    int64_t symbolTimestamp_ = 0;
+    // Time of the last checkSymbolUpdate that looked at the file.
+    uint64_t symbolChecked_ = 0;
+    bool symbolLoading_ = false;
     ZhuyinConfig config_;
     KeyList selectionKeys_;
     bool isZhuyin_ = true;
+    // Options of the default input method "zhuyin".
+    ZhuyinContextOptions contextOptions_;
+    // Options of the input methods from profiles, by unique name.
+    std::unordered_map<std::string, ZhuyinContextOptions> profiles_;
+    // Options that are currently set on context_, and the unique name of
+    // the input method they are applied for.
+    ZhuyinContextOptions appliedOptions_;
+    std::string appliedProfile_ = "zhuyin";
+    std::unique_ptr<EventSourceTime> releaseTimer_;
+    // Used by the public API, share the context with input contexts.
+    std::unique_ptr<ZhuyinBuffer> queryBuffer_;
+    std::unique_ptr<HandlerTableEntry<QuickPhraseProviderCallback>>
+        symbolProvider_;
+    // Saves are skipped while user dictionary is compacted, until the
+    // compacted one replaces context_.
+    bool compacting_ = false;
+    int64_t compactedSize_ = 0;
+    std::shared_ptr<ZhuyinCompactResult> compactResult_;
+    // Sentences committed during compaction with their profile. Training
+    // them into the old context would be lost with it, so they are trained
+    // once the compacted context is in place. They are also kept in a file
+    // until then, see appendUntrained.
+    ZhuyinUntrained untrained_;
+    std::unique_ptr<EventSourceTime> replaceContextTimer_;
+    EventDispatcher dispatcher_;
+    // Need to be destructed before dispatcher_.
+    std::future<void> symbolLoader_;
+    std::future<void> compactor_;
+    // Requests of convertAsync, converted one per main loop iteration.
+    std::deque<std::pair<std::string, std::function<void(const std::string &)>>>
+        convertQueue_;
+    std::unique_ptr<EventSourceTime> convertTimer_;
 };
 
 class ZhuyinEngineFactory final : public AddonFactory {
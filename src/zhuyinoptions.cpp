@@ -0,0 +1,62 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "zhuyinoptions.h"
+#include <fcitx-utils/macros.h>
+#include <string_view>
+#include <zhuyin.h>
+
+namespace fcitx {
+
+namespace {
+
+struct LayoutName {
+    const char *name;
+    bool isZhuyin;
+    ZhuyinScheme scheme;
+    FullPinyinScheme pinyinScheme;
+};
+
+constexpr LayoutName layouts[] = {
+    {"Standard", true, ZHUYIN_STANDARD, FULL_PINYIN_HANYU},
+    {"Hsu", true, ZHUYIN_HSU, FULL_PINYIN_HANYU},
+    {"IBM", true, ZHUYIN_IBM, FULL_PINYIN_HANYU},
+    {"GinYieh", true, ZHUYIN_GINYIEH, FULL_PINYIN_HANYU},
+    {"Eten", true, ZHUYIN_ETEN, FULL_PINYIN_HANYU},
+    {"Eten26", true, ZHUYIN_ETEN26, FULL_PINYIN_HANYU},
+    {"Standard Dvorak", true, ZHUYIN_STANDARD_DVORAK, FULL_PINYIN_HANYU},
+    {"Hsu Dvorak", true, ZHUYIN_HSU_DVORAK, FULL_PINYIN_HANYU},
+    {"Dachen CP26", true, ZHUYIN_DACHEN_CP26, FULL_PINYIN_HANYU},
+    {"Hanyu", false, ZHUYIN_STANDARD, FULL_PINYIN_HANYU},
+    {"Luoma", false, ZHUYIN_STANDARD, FULL_PINYIN_LUOMA},
+    {"Secondary Zhuyin", false, ZHUYIN_STANDARD,
+     FULL_PINYIN_SECONDARY_ZHUYIN},
+};
+
+} // namespace
+
+bool ZhuyinContextOptions::setLayout(std::string_view name) {
+    for (size_t i = 0; i < FCITX_ARRAY_SIZE(layouts); i++) {
+        if (name == layouts[i].name) {
+            isZhuyin = layouts[i].isZhuyin;
+            scheme = layouts[i].scheme;
+            pinyinScheme = layouts[i].pinyinScheme;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ZhuyinContextOptions::apply(zhuyin_context_t *context) const {
+    if (isZhuyin) {
+        zhuyin_set_chewing_scheme(context, scheme);
+    } else {
+        zhuyin_set_full_pinyin_scheme(context, pinyinScheme);
+    }
+    zhuyin_set_options(context, options);
+}
+
+} // namespace fcitx
@@ -0,0 +1,38 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_ZHUYIN_ZHUYINOPTIONS_H_
+#define _FCITX5_ZHUYIN_ZHUYINOPTIONS_H_
+
+#include <string_view>
+#include <zhuyin.h>
+
+namespace fcitx {
+
+// Scheme and parser options that are set on a zhuyin_context_t.
+struct ZhuyinContextOptions {
+    bool isZhuyin = true;
+    ZhuyinScheme scheme = ZHUYIN_STANDARD;
+    FullPinyinScheme pinyinScheme = FULL_PINYIN_HANYU;
+    pinyin_option_t options = USE_TONE | ZHUYIN_CORRECT_ALL;
+
+    // Set scheme by layout name, the name is the same as the one used in
+    // configuration file, e.g. "Standard" or "Hsu Dvorak".
+    bool setLayout(std::string_view name);
+    void apply(zhuyin_context_t *context) const;
+
+    bool operator==(const ZhuyinContextOptions &other) const {
+        return isZhuyin == other.isZhuyin && scheme == other.scheme &&
+               pinyinScheme == other.pinyinScheme && options == other.options;
+    }
+    bool operator!=(const ZhuyinContextOptions &other) const {
+        return !operator==(other);
+    }
+};
+
+} // namespace fcitx
+
+#endif // _FCITX5_ZHUYIN_ZHUYINOPTIONS_H_
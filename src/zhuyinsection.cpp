@@ -5,8 +5,11 @@
  *
  */
 #include "zhuyinsection.h"
+#include "zhuyinarena.h"
 #include "zhuyinbuffer.h"
 #include "zhuyincandidate.h"
+#include "zhuyinwatchdog.h"
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
@@ -16,11 +19,15 @@
 #include <fcitx-utils/utf8.h>
 #include <functional>
 #include <glib.h>
+#include <iterator>
 #include <limits>
 #include <memory>
+#include <memory_resource>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 #include <zhuyin.h>
 
 namespace fcitx {
@@ -44,6 +51,7 @@ ZhuyinSection::ZhuyinSection(uint32_t init, ZhuyinSectionType type,
 }
 
 bool ZhuyinSection::typeImpl(const char *s, size_t length) {
+    const auto offset = cursor();
     InputBuffer::typeImpl(s, length);
     if (!instance_) {
         const auto &candidates = provider_->symbol().lookup(userInput());
@@ -54,13 +62,167 @@ bool ZhuyinSection::typeImpl(const char *s, size_t length) {
         }
         return true;
     }
-    if (provider_->isZhuyin()) {
-        zhuyin_parse_more_chewings(instance_.get(), userInput().data());
-    } else {
-        zhuyin_parse_more_full_pinyins(instance_.get(), userInput().data());
+    shiftChoices(offset, offset, cursor() - offset);
+    update(offset);
+    return true;
+}
+
+void ZhuyinSection::insert(std::string_view text,
+                           std::vector<ZhuyinChoice> choices) {
+    assert(instance_);
+    const auto offset = cursor();
+    if (!InputBuffer::typeImpl(text.data(), text.size())) {
+        return;
+    }
+    shiftChoices(offset, offset, text.size());
+    for (auto &choice : choices) {
+        choice.begin += offset;
+        choice.end += offset;
+    }
+    auto iter = std::lower_bound(
+        choices_.begin(), choices_.end(), offset,
+        [](const ZhuyinChoice &choice, size_t offset) {
+            return choice.begin < offset;
+        });
+    choices_.insert(iter, std::make_move_iterator(choices.begin()),
+                    std::make_move_iterator(choices.end()));
+    update(offset);
+}
+
+std::vector<ZhuyinChoice> ZhuyinSection::choicesFrom(size_t offset) const {
+    std::vector<ZhuyinChoice> result;
+    for (const auto &choice : choices_) {
+        if (choice.begin >= offset) {
+            result.push_back(
+                {choice.begin - offset, choice.end - offset, choice.text});
+        }
+    }
+    return result;
+}
+
+size_t ZhuyinSection::chooseCandidate(size_t offset,
+                                      lookup_candidate_t *candidate) {
+    const gchar *word = nullptr;
+    zhuyin_get_candidate_string(instance_.get(), candidate, &word);
+    std::string text = word ? word : "";
+    size_t end = zhuyin_choose_candidate(instance_.get(), offset, candidate);
+    candidateRevision_ += 1;
+    guess();
+
+    // libzhuyin clears the constraints overlapping with the new one.
+    choices_.erase(std::remove_if(choices_.begin(), choices_.end(),
+                                  [offset, end](const ZhuyinChoice &choice) {
+                                      return choice.begin < end &&
+                                             choice.end > offset;
+                                  }),
+                   choices_.end());
+    if (end > offset) {
+        auto iter = std::lower_bound(
+            choices_.begin(), choices_.end(), offset,
+            [](const ZhuyinChoice &choice, size_t offset) {
+                return choice.begin < offset;
+            });
+        choices_.insert(iter, ZhuyinChoice{offset, end, std::move(text)});
+    }
+    return end;
+}
+
+void ZhuyinSection::shiftChoices(size_t from, size_t to, size_t length) {
+    auto iter = choices_.begin();
+    while (iter != choices_.end()) {
+        if (iter->begin < to && iter->end > from) {
+            iter = choices_.erase(iter);
+            continue;
+        }
+        if (iter->begin >= to) {
+            iter->begin = iter->begin - (to - from) + length;
+            iter->end = iter->end - (to - from) + length;
+        }
+        ++iter;
     }
+}
+
+bool ZhuyinSection::restoreChoice(const ZhuyinChoice &choice) {
+    candidateRevision_ += 1;
+    if (choice.end > parsedZhuyinLength() ||
+        !zhuyin_guess_candidates_after_cursor(instance_.get(), choice.begin)) {
+        return false;
+    }
+    guint len = 0;
+    zhuyin_get_n_candidate(instance_.get(), &len);
+    for (guint i = 0; i < len; i++) {
+        lookup_candidate_t *candidate = nullptr;
+        const gchar *word = nullptr;
+        if (!zhuyin_get_candidate(instance_.get(), i, &candidate) ||
+            !zhuyin_get_candidate_string(instance_.get(), candidate, &word) ||
+            choice.text != word) {
+            continue;
+        }
+        return static_cast<size_t>(zhuyin_choose_candidate(
+                   instance_.get(), choice.begin, candidate)) == choice.end;
+    }
+    return false;
+}
+
+void ZhuyinSection::update(size_t offset) {
+    candidateRevision_ += 1;
+    {
+        ZhuyinPhaseTimer timer(ZhuyinPhase::Parse);
+        if (provider_->isZhuyin()) {
+            zhuyin_parse_more_chewings(instance_.get(), userInput().data());
+        } else {
+            zhuyin_parse_more_full_pinyins(instance_.get(),
+                                           userInput().data());
+        }
+        // libzhuyin keeps the constraints that still match the keys at their
+        // offset, also those left at the offset of a choice moved by the
+        // change. Clear everything after the change, and choose the moved
+        // choices again at their new offset.
+        for (size_t i = offset, e = parsedZhuyinLength(); i < e; i++) {
+            zhuyin_clear_constraint(instance_.get(), i);
+        }
+        auto iter = choices_.begin();
+        while (iter != choices_.end()) {
+            if (iter->end > offset && !restoreChoice(*iter)) {
+                iter = choices_.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+    }
+    // Expect the guess to take as long as the last one, and leave it to the
+    // engine to finish after the key is handled.
+    if (const auto budget = provider_->guessBudget();
+        budget && guessTime_ > budget) {
+        pendingFrom_ = guessPending_ ? std::min(pendingFrom_, offset) : offset;
+        guessPending_ = true;
+        return;
+    }
+    guess();
+}
+
+void ZhuyinSection::guess() const {
+    ZhuyinPhaseTimer timer(ZhuyinPhase::Guess);
+    guessPending_ = false;
+    const auto start = provider_->guessClock();
     zhuyin_guess_sentence(instance_.get());
-    return true;
+    guessTime_ = provider_->guessClock() - start;
+    if (!provider_->guessBudget()) {
+        return;
+    }
+    char *sentence = nullptr;
+    guessedLength_ = parsedZhuyinLength();
+    if (guessedLength_) {
+        zhuyin_get_sentence(instance_.get(), &sentence);
+    }
+    guessedSentence_ = sentence ? sentence : "";
+    free(sentence);
+}
+
+void ZhuyinSection::finishGuess() const {
+    if (guessPending_) {
+        guess();
+    }
 }
 
 size_t ZhuyinSection::prevChar() const {
@@ -97,12 +259,8 @@ size_t ZhuyinSection::nextChar() const {
 
 void ZhuyinSection::erase(size_t from, size_t to) {
     InputBuffer::erase(from, to);
-    if (provider_->isZhuyin()) {
-        zhuyin_parse_more_chewings(instance_.get(), userInput().data());
-    } else {
-        zhuyin_parse_more_full_pinyins(instance_.get(), userInput().data());
-    }
-    zhuyin_guess_sentence(instance_.get());
+    shiftChoices(from, to, 0);
+    update(from);
 }
 
 void ZhuyinSection::setSymbol(std::string symbol) {
@@ -115,13 +273,25 @@ void ZhuyinSection::learn() {
     if (!instance_) {
         return;
     }
+    finishGuess();
+    ZhuyinPhaseTimer timer(ZhuyinPhase::Train);
     zhuyin_train(instance_.get());
 }
 
 std::pair<std::string, size_t> ZhuyinSection::preeditWithCursor() const {
-    std::string result;
+    std::pmr::string result(ZhuyinArena::resource());
+    auto cursor = appendPreedit(result);
+    return {std::string(result), cursor};
+}
+
+size_t ZhuyinSection::appendPreedit(std::pmr::string &result) const {
+    const auto start = result.size();
     if (!instance_) {
-        return {currentSymbol_, currentSymbol_.size()};
+        result.append(currentSymbol_);
+        return currentSymbol_.size();
+    }
+    if (guessPending_) {
+        return appendPendingPreedit(result);
     }
 
     auto length = parsedZhuyinLength();
@@ -149,23 +319,57 @@ std::pair<std::string, size_t> ZhuyinSection::preeditWithCursor() const {
 
     free(sentence);
     for (; length < size(); length++) {
-        if (provider_->isZhuyin()) {
-            gchar **symbols = nullptr;
-            zhuyin_in_chewing_keyboard(instance_.get(), charAt(length),
-                                       &symbols);
-            if (symbols && symbols[0]) {
-                result.append(symbols[0]);
-            }
-            g_strfreev(symbols);
-        } else {
-            result.push_back(static_cast<char>(charAt(length)));
+        appendKey(result, charAt(length));
+        if (length + 1 == cursor()) {
+            preeditCursor = result.size() - start;
         }
+    }
+    return preeditCursor;
+}
 
-        if (length + 1 == cursor()) {
-            preeditCursor = result.size();
+size_t ZhuyinSection::preeditLength() const {
+    if (instance_ && guessPending_) {
+        // Every parsed syllable becomes one character, instead of the up to
+        // four symbols shown while the guess is pending.
+        guint syllables = 0;
+        zhuyin_get_n_zhuyin(instance_.get(), &syllables);
+        return syllables + size() - parsedZhuyinLength();
+    }
+    std::pmr::string preedit(ZhuyinArena::resource());
+    appendPreedit(preedit);
+    return utf8::length(preedit.begin(), preedit.end());
+}
+
+size_t ZhuyinSection::appendPendingPreedit(std::pmr::string &result) const {
+    const auto start = result.size();
+    size_t from = 0;
+    if (pendingFrom_ >= guessedLength_ && guessedLength_ <= size()) {
+        result.append(guessedSentence_);
+        from = guessedLength_;
+    }
+    // Cursor within the guessed part can not be mapped without a guess, put
+    // it after the sentence.
+    size_t preeditCursor = cursor() ? result.size() - start : 0;
+    for (auto i = from; i < size(); i++) {
+        appendKey(result, charAt(i));
+        if (i + 1 == cursor()) {
+            preeditCursor = result.size() - start;
         }
     }
-    return {result, preeditCursor};
+    return preeditCursor;
+}
+
+void ZhuyinSection::appendKey(std::pmr::string &result, uint32_t c) const {
+    if (provider_->isZhuyin()) {
+        gchar **symbols = nullptr;
+        zhuyin_in_chewing_keyboard(instance_.get(), c, &symbols);
+        if (symbols && symbols[0]) {
+            result.append(symbols[0]);
+        }
+        g_strfreev(symbols);
+    } else {
+        result.push_back(static_cast<char>(c));
+    }
 }
 
 size_t ZhuyinSection::parsedZhuyinLength() const {
@@ -207,6 +411,8 @@ void ZhuyinSection::showCandidate(
         return;
     }
 
+    // Candidates replace part of the sentence, which needs to be up to date.
+    finishGuess();
     if (offset >= parsedZhuyinLength()) {
         if (!provider_->isZhuyin() || offset >= size()) {
             return;
@@ -228,6 +434,7 @@ void ZhuyinSection::showCandidate(
     }
 
     zhuyin_get_zhuyin_offset(instance_.get(), offset, &offset);
+    candidateRevision_ += 1;
     zhuyin_guess_candidates_after_cursor(instance_.get(), offset);
     guint len = 0;
     zhuyin_get_n_candidate(instance_.get(), &len);
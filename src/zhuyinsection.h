@@ -14,8 +14,11 @@
 #include <functional>
 #include <list>
 #include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 #include <zhuyin.h>
 
 namespace fcitx {
@@ -31,6 +34,20 @@ enum class ZhuyinSectionType {
     Symbol,
 };
 
+// A candidate chosen by user, offsets are in bytes of user input.
+struct ZhuyinChoice {
+    size_t begin;
+    size_t end;
+    std::string text;
+};
+
+// Input of a zhuyin section with the choices made in it, enough to type it
+// again into another context.
+struct ZhuyinSentence {
+    std::string input;
+    std::vector<ZhuyinChoice> choices;
+};
+
 // A section of preedit, it can be either a single symbol, or a series of
 // Zhuyin.
 class ZhuyinSection : public InputBuffer {
@@ -46,28 +63,75 @@ public:
 
     std::string preedit() const;
     std::pair<std::string, size_t> preeditWithCursor() const;
+    // Append preedit to result, return the cursor relative to where it
+    // starts.
+    size_t appendPreedit(std::pmr::string &result) const;
+    // Length of preedit in characters once guessed, also when the guess is
+    // pending.
+    size_t preeditLength() const;
     size_t prevChar() const;
     size_t nextChar() const;
 
     void erase(size_t from, size_t to) override;
     void setSymbol(std::string symbol);
+    // Type text at cursor, together with the choices made within text, so
+    // split and merged sections do not lose what user has selected.
+    void insert(std::string_view text, std::vector<ZhuyinChoice> choices);
+    // Choices that start at or after offset, relative to offset.
+    std::vector<ZhuyinChoice> choicesFrom(size_t offset) const;
+    // Choose candidate at offset and remember it, return the new offset.
+    size_t chooseCandidate(size_t offset, lookup_candidate_t *candidate);
 
     void showCandidate(
         const std::function<void(std::unique_ptr<ZhuyinCandidate>)> &callback,
         SectionIterator iter, size_t offset);
     void learn();
+    // Whether the sentence is not guessed since the last change, because the
+    // guess is expected to exceed ZhuyinProviderInterface::guessBudget.
+    bool guessPending() const { return guessPending_; }
+    // Guess the pending sentence now.
+    void finishGuess() const;
     auto instance() const { return instance_.get(); }
     auto buffer() const { return buffer_; }
+    // Changed whenever the candidates fetched from instance may be invalid.
+    uint64_t candidateRevision() const { return candidateRevision_; }
 
 protected:
     bool typeImpl(const char *s, size_t length) override;
 
 private:
+    // Input in [from, to) is replaced by length bytes. Drop the choices
+    // overlapping with it, and move the choices after it.
+    void shiftChoices(size_t from, size_t to, size_t length);
+    // Parse the input, restore the choices touched by the change at offset
+    // and guess the sentence once.
+    void update(size_t offset);
+    bool restoreChoice(const ZhuyinChoice &choice);
+    void guess() const;
+    // Preedit shown while the guess is pending, the last guessed sentence
+    // followed by the keys typed since then.
+    size_t appendPendingPreedit(std::pmr::string &result) const;
+    // Append the symbol of a key that is not converted.
+    void appendKey(std::pmr::string &result, uint32_t c) const;
+
     ZhuyinProviderInterface *provider_;
     ZhuyinBuffer *buffer_;
     const ZhuyinSectionType type_;
     std::string currentSymbol_;
     UniqueCPtr<zhuyin_instance_t, zhuyin_free_instance> instance_;
+    // Sorted by begin, never overlap.
+    std::vector<ZhuyinChoice> choices_;
+    uint64_t candidateRevision_ = 0;
+    // Pending guess is finished by const readers such as ZhuyinBuffer::text.
+    mutable bool guessPending_ = false;
+    // Smallest offset changed since the last guess.
+    size_t pendingFrom_ = 0;
+    // Duration of the last guess in usec.
+    mutable uint64_t guessTime_ = 0;
+    // Sentence of the last guess and the length of input it covers, only
+    // kept when there is a budget.
+    mutable std::string guessedSentence_;
+    mutable size_t guessedLength_ = 0;
 };
 
 } // namespace fcitx
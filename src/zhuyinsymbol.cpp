@@ -5,15 +5,19 @@
  *
  */
 #include "zhuyinsymbol.h"
+#include <algorithm>
 #include <cstddef>
 #include <cstdio>
+#include <fcitx-utils/charutils.h>
 #include <fcitx-utils/log.h>
 #include <fcitx-utils/macros.h>
 #include <fcitx-utils/misc.h>
 #include <fcitx-utils/stringutils.h>
 #include <fcitx-utils/unixfd.h>
+#include <functional>
 #include <istream>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -21,6 +25,87 @@ namespace fcitx {
 
 namespace {
 const std::vector<std::string> empty;
+
+std::string lowerCase(std::string_view str) {
+    std::string result(str);
+    for (auto &c : result) {
+        c = charutils::tolower(c);
+    }
+    return result;
+}
+
+constexpr const char *const punctuation[] = {
+    "，", "。", "？", "！", "、", "；", "：", "…", "・", "—", "「", "」", "（", "）", "《",
+    "》", "『", "』", "〈", "〉", "～", "＿", "﹏", nullptr};
+constexpr const char *const commonSymbols[] = {
+    "‥", "﹐", "﹒", "˙", "·", "‘", "’", "“", "”", "〝", "〞", "‵", "′", "〃", "～",
+    "＄", "％", "＠", "＆", "＃", "＊", nullptr};
+constexpr const char *const brackets[] = {
+    "（", "）", "「", "」", "〔", "〕", "｛", "｝", "〈", "〉", "『", "』", "《", "》", "【",
+    "】", "﹙", "﹚", "﹝", "﹞", "﹛", "﹜", nullptr};
+constexpr const char *const verticalBrackets[] = {
+    "︵", "︶", "﹁", "﹂", "︹", "︺", "︷", "︸", "︿", "﹀", "﹃", "﹄", "︽", "︾", "︻︼",
+    nullptr};
+constexpr const char *const greek[] = {
+    "α", "β", "γ", "δ", "ε", "ζ", "η", "θ", "ι", "κ", "λ", "μ", "ν", "ξ", "ο",
+    "π", "ρ", "σ", "τ", "υ", "φ", "χ", "ψ", "ω", "Α", "Β", "Γ", "Δ", "Ε", "Ζ",
+    "Η", "Θ", "Ι", "Κ", "Λ", "Μ", "Ν", "Ξ", "Ο", "Π", "Ρ", "Σ", "Τ", "Υ", "Φ",
+    "Χ", "Ψ", "Ω", nullptr};
+constexpr const char *const math[] = {
+    "＋", "－", "×", "÷", "＝", "≠", "≒", "∞", "±", "√", "＜", "＞", "﹤", "﹥", "≦",
+    "≧", "∩", "∪", "ˇ", "⊥", "∠", "∟", "⊿", "㏒", "㏑", "∫", "∮", "∵", "∴", "╳",
+    "﹢", nullptr};
+constexpr const char *const shapes[] = {
+    "↑", "↓", "←", "→", "↖", "↗", "↙", "↘", "㊣", "◎", "○", "●", "⊕", "⊙", "○",
+    "●", "△", "▲", "☆", "★", "◇", "◆", "□", "■", "▽", "▼", "§", "￥", "〒", "￠",
+    "￡", "※", "♀", "♂", nullptr};
+constexpr const char *const pictographs[] = {
+    "♨", "☀", "☁", "☂", "☃", "♠", "♥", "♣", "♦", "♩", "♪", "♫", "♬", "☺", "☻",
+    nullptr};
+constexpr const char *const singleLineBox[] = {
+    "├", "─", "┼", "┴", "┬", "┤", "┌", "┐", "╞", "═", "╪", "╡", "│", "▕", "└",
+    "┘", "╭", "╮", "╰", "╯", nullptr};
+constexpr const char *const doubleLineBox[] = {
+    "╔", "╦", "╗", "╠", "═", "╬", "╣", "╓", "╥", "╖", "╒", "╤", "╕", "║", "╚",
+    "╩", "╝", "╟", "╫", "╢", "╙", "╨", "╜", "╞", "╪", "╡", "╘", "╧", "╛",
+    nullptr};
+constexpr const char *const blocks[] = {
+    "＿", "ˍ", "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█", "▏", "▎", "▍", "▌", "▋",
+    "▊", "▉", "◢", "◣", "◥", "◤", nullptr};
+constexpr const char *const lines[] = {
+    "﹣", "﹦", "≡", "｜", "∣", "∥", "–", "︱", "—", "︳", "╴", "¯", "￣", "﹉", "﹊",
+    "﹍", "﹎", "﹋", "﹌", "﹏", "︴", "∕", "﹨", "╱", "╲", "／", "＼", nullptr};
+
+constexpr ZhuyinSymbolCategory categories[] = {
+    {"a", "punctuation", "標點符號", punctuation},
+    {"b", "common", "常用符號", commonSymbols},
+    {"c", "brackets", "左右括號", brackets},
+    {"d", "vertical", "上下括號", verticalBrackets},
+    {"e", "greek", "希臘字母", greek},
+    {"f", "math", "數學符號", math},
+    {"g", "shapes", "特殊圖形", shapes},
+    {"h", "unicode", "Unicode", pictographs},
+    {"i", "box", "單線框", singleLineBox},
+    {"j", "doublebox", "雙線框", doubleLineBox},
+    {"k", "blocks", "填色方塊", blocks},
+    {"l", "lines", "線段", lines},
+};
+
+} // namespace
+
+size_t ZhuyinSymbol::categoryCount() { return FCITX_ARRAY_SIZE(categories); }
+
+const ZhuyinSymbolCategory &ZhuyinSymbol::category(size_t index) {
+    return categories[index];
+}
+
+const ZhuyinSymbolCategory *ZhuyinSymbol::findCategory(std::string_view key) {
+    for (const auto &category : categories) {
+        if (key == category.key) {
+            return &category;
+        }
+    }
+    return nullptr;
 }
 
 ZhuyinSymbol::ZhuyinSymbol() { initBuiltin(); }
@@ -33,6 +118,11 @@ ZhuyinSymbol::lookup(const std::string &key) const {
     return empty;
 }
 void ZhuyinSymbol::reset() {
+    resetSymbols();
+    buildIndex();
+}
+
+void ZhuyinSymbol::resetSymbols() {
     symbols_.clear();
     initBuiltin();
     for (char c = 'A'; c <= 'Z'; c++) {
@@ -42,7 +132,7 @@ void ZhuyinSymbol::reset() {
 }
 
 void ZhuyinSymbol::load(std::istream &in) {
-    reset();
+    resetSymbols();
     std::string line;
     while (std::getline(in, line)) {
         auto trimmed = stringutils::trimView(line);
@@ -70,6 +160,48 @@ void ZhuyinSymbol::load(std::istream &in) {
         }
         symbols_[std::string(key)] = std::move(items);
     }
+    buildIndex();
+}
+
+void ZhuyinSymbol::buildIndex() {
+    index_.clear();
+    for (const auto &[key, symbols] : symbols_) {
+        for (const auto &symbol : symbols) {
+            // easysymbols.txt lists the key itself as a candidate.
+            if (symbol != key) {
+                index_.push_back({lowerCase(key), key, symbol});
+            }
+        }
+    }
+    for (const auto &category : categories) {
+        for (const auto *symbol = category.symbols; *symbol; ++symbol) {
+            index_.push_back({category.name, category.name, *symbol});
+        }
+    }
+    // Stable, so symbols of a key keep their order.
+    std::stable_sort(index_.begin(), index_.end(),
+                     [](const IndexEntry &lhs, const IndexEntry &rhs) {
+                         return lhs.searchKey < rhs.searchKey;
+                     });
+}
+
+void ZhuyinSymbol::search(
+    std::string_view prefix,
+    const std::function<bool(const std::string &, const std::string &)>
+        &callback) const {
+    const auto searchPrefix = lowerCase(prefix);
+    auto iter = std::lower_bound(
+        index_.begin(), index_.end(), searchPrefix,
+        [](const IndexEntry &entry, const std::string &prefix) {
+            return entry.searchKey < prefix;
+        });
+    for (; iter != index_.end() &&
+           stringutils::startsWith(iter->searchKey, searchPrefix);
+         ++iter) {
+        if (!callback(iter->key, iter->symbol)) {
+            break;
+        }
+    }
 }
 
 void ZhuyinSymbol::initBuiltin() {
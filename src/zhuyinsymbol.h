@@ -7,27 +7,68 @@
 #ifndef _FCITX5_ZHUYIN_ZHUYINSYMBOL_H_
 #define _FCITX5_ZHUYIN_ZHUYINSYMBOL_H_
 
+#include <cstddef>
 #include <cstdio>
+#include <functional>
 #include <istream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 namespace fcitx {
 
+// A group of symbols that can be typed with "sy" and key in QuickPhrase.
+struct ZhuyinSymbolCategory {
+    const char *key;
+    // ASCII name that can be searched, see ZhuyinSymbol::search.
+    const char *name;
+    const char *description;
+    // Terminated by nullptr.
+    const char *const *symbols;
+};
+
 class ZhuyinSymbol {
 public:
+    static size_t categoryCount();
+    static const ZhuyinSymbolCategory &category(size_t index);
+    static const ZhuyinSymbolCategory *findCategory(std::string_view key);
+
     ZhuyinSymbol();
+    // Replace the symbols with builtin ones and those of easysymbols.txt.
     void load(std::istream &in);
     const std::vector<std::string> &lookup(const std::string &key) const;
+    // Replace the symbols with builtin ones.
     void reset();
     void initBuiltin();
     void clear();
 
+    // Call callback with every symbol that has a key starting with prefix,
+    // ignoring ASCII case, ordered by key. Keys are those of easysymbols.txt
+    // and builtin groups, and names of categories. Stop if callback returns
+    // false. The index is built by load and reset, so nothing is found
+    // before either is called.
+    void search(std::string_view prefix,
+                const std::function<bool(const std::string &key,
+                                         const std::string &symbol)>
+                    &callback) const;
+
 private:
+    struct IndexEntry {
+        // Lower case, compared with prefix.
+        std::string searchKey;
+        std::string key;
+        std::string symbol;
+    };
+
+    void resetSymbols();
+    void buildIndex();
+
     std::unordered_map<std::string, std::vector<std::string>> symbols_;
     std::unordered_map<std::string, size_t> symbolToGroup_;
     std::vector<std::vector<std::string>> groups_;
+    // Sorted by searchKey, prefix matches are found with binary search.
+    std::vector<IndexEntry> index_;
 };
 
 } // namespace fcitx
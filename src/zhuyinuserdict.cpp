@@ -0,0 +1,275 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "zhuyinuserdict.h"
+#include "zhuyinsection.h"
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/misc.h>
+#include <filesystem>
+#include <fstream>
+#include <glib.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <zhuyin.h>
+
+namespace fcitx {
+
+namespace {
+
+// Files written by libzhuyin for learned phrases, see table.conf.
+constexpr const char *userFiles[] = {"user.bin", "user_bigram.db"};
+
+// One line per sentence: profile, input, then begin, end and text of every
+// choice, separated by tab.
+constexpr char untrainedFile[] = "untrained.txt";
+
+struct UserPhrase {
+    std::string phrase;
+    std::string zhuyin;
+    gint count;
+};
+
+UniqueCPtr<zhuyin_context_t, zhuyin_fini>
+loadContext(const std::string &systemDir, const std::string &userDir,
+            uint64_t *loadTime) {
+    UniqueCPtr<zhuyin_context_t, zhuyin_fini> context(
+        zhuyin_init(systemDir.data(), userDir.data()));
+    if (!context) {
+        return context;
+    }
+    const auto start = now(CLOCK_MONOTONIC);
+    zhuyin_load_phrase_library(context.get(), USER_DICTIONARY);
+    *loadTime = now(CLOCK_MONOTONIC) - start;
+    return context;
+}
+
+uint64_t save(zhuyin_context_t *context) {
+    const auto start = now(CLOCK_MONOTONIC);
+    zhuyin_save(context);
+    return now(CLOCK_MONOTONIC) - start;
+}
+
+std::vector<UserPhrase> userPhrases(zhuyin_context_t *context) {
+    std::vector<UserPhrase> phrases;
+    auto *iter = zhuyin_begin_get_phrases(context, USER_DICTIONARY);
+    if (!iter) {
+        return phrases;
+    }
+    while (zhuyin_iterator_has_next_phrase(iter)) {
+        gchar *phrase = nullptr;
+        gchar *zhuyin = nullptr;
+        gint count = 0;
+        if (zhuyin_iterator_get_next_phrase(iter, &phrase, &zhuyin, &count)) {
+            phrases.push_back({phrase, zhuyin, count});
+        }
+        g_free(phrase);
+        g_free(zhuyin);
+    }
+    zhuyin_end_get_phrases(iter);
+    return phrases;
+}
+
+void garrayFree(GArray *array) { g_array_free(array, TRUE); }
+
+bool hasSeparator(std::string_view text) {
+    return text.find_first_of("\t\n") != std::string_view::npos;
+}
+
+bool parseOffset(std::string_view text, size_t *offset) {
+    const auto *end = text.data() + text.size();
+    auto [ptr, ec] = std::from_chars(text.data(), end, *offset);
+    return ec == std::errc() && ptr == end;
+}
+
+} // namespace
+
+std::string ZhuyinCompactResult::toString() const {
+    std::stringstream sstream;
+    sstream << "phrases: " << phrasesBefore << " -> " << phrasesAfter
+            << ", size: " << sizeBefore << " -> " << sizeAfter
+            << " bytes, load: " << loadBefore << " -> " << loadAfter
+            << "us, save: " << saveBefore << " -> " << saveAfter << "us";
+    return sstream.str();
+}
+
+int64_t userDictionarySize(const std::string &userDir) {
+    int64_t size = 0;
+    for (const auto *file : userFiles) {
+        std::error_code ec;
+        auto fileSize = std::filesystem::file_size(
+            std::filesystem::path(userDir) / file, ec);
+        if (!ec) {
+            size += fileSize;
+        }
+    }
+    return size;
+}
+
+ZhuyinCompactResult compactUserDictionary(const std::string &systemDir,
+                                          const std::string &userDir,
+                                          const ZhuyinCompactPolicy &policy) {
+    ZhuyinCompactResult result;
+    result.sizeBefore = userDictionarySize(userDir);
+    auto context = loadContext(systemDir, userDir, &result.loadBefore);
+    if (!context) {
+        return result;
+    }
+    // Saving unchanged data measures what every save costs now.
+    result.saveBefore = save(context.get());
+
+    const auto before = userPhrases(context.get());
+    result.phrasesBefore = before.size();
+    auto phrases = before;
+    phrases.erase(std::remove_if(phrases.begin(), phrases.end(),
+                                 [&policy](const UserPhrase &phrase) {
+                                     return phrase.count < policy.minCount;
+                                 }),
+                  phrases.end());
+    if (phrases.size() > policy.maxPhrases) {
+        std::stable_sort(phrases.begin(), phrases.end(),
+                         [](const UserPhrase &lhs, const UserPhrase &rhs) {
+                             return lhs.count > rhs.count;
+                         });
+        phrases.resize(policy.maxPhrases);
+    }
+
+    // Mask out only the user tokens of dropped phrases, the kept ones keep
+    // their token ids and with them their bigram.
+    std::unordered_set<std::string> kept;
+    for (const auto &phrase : phrases) {
+        kept.insert(phrase.phrase);
+    }
+    UniqueCPtr<zhuyin_instance_t, zhuyin_free_instance> instance(
+        zhuyin_alloc_instance(context.get()));
+    if (!instance) {
+        return result;
+    }
+    UniqueCPtr<GArray, garrayFree> tokens(
+        g_array_new(FALSE, FALSE, sizeof(phrase_token_t)));
+    std::unordered_set<std::string> dropped;
+    for (const auto &phrase : before) {
+        if (kept.count(phrase.phrase) ||
+            !dropped.insert(phrase.phrase).second) {
+            continue;
+        }
+        g_array_set_size(tokens.get(), 0);
+        zhuyin_lookup_tokens(instance.get(), phrase.phrase.data(),
+                             tokens.get());
+        for (guint i = 0; i < tokens->len; i++) {
+            auto token = g_array_index(tokens.get(), phrase_token_t, i);
+            if (PHRASE_INDEX_LIBRARY_INDEX(token) == USER_DICTIONARY) {
+                zhuyin_mask_out(context.get(),
+                                PHRASE_INDEX_LIBRARY_MASK | PHRASE_MASK, token);
+            }
+        }
+    }
+    instance.reset();
+    // A dropped pronunciation of a kept phrase shares its token and stays.
+    result.phrasesAfter =
+        dropped.empty() ? before.size() : userPhrases(context.get()).size();
+    result.saveAfter = save(context.get());
+    context.reset();
+
+    result.sizeAfter = userDictionarySize(userDir);
+    result.context = loadContext(systemDir, userDir, &result.loadAfter);
+    result.success = static_cast<bool>(result.context);
+    return result;
+}
+
+bool appendUntrained(const std::string &userDir, const std::string &profile,
+                     const std::vector<ZhuyinSentence> &sentences) {
+    std::ofstream out(std::filesystem::path(userDir) / untrainedFile,
+                      std::ios::app | std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    for (const auto &sentence : sentences) {
+        // Such input can not be typed with any layout, it is not worth an
+        // escape syntax.
+        if (hasSeparator(sentence.input) ||
+            std::any_of(sentence.choices.begin(), sentence.choices.end(),
+                        [](const ZhuyinChoice &choice) {
+                            return hasSeparator(choice.text);
+                        })) {
+            continue;
+        }
+        out << profile << '\t' << sentence.input;
+        for (const auto &choice : sentence.choices) {
+            out << '\t' << choice.begin << '\t' << choice.end << '\t'
+                << choice.text;
+        }
+        out << '\n';
+    }
+    out.flush();
+    return static_cast<bool>(out);
+}
+
+ZhuyinUntrained loadUntrained(const std::string &userDir) {
+    ZhuyinUntrained result;
+    std::ifstream in(std::filesystem::path(userDir) / untrainedFile,
+                     std::ios::binary);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::vector<std::string_view> fields;
+        std::string_view rest = line;
+        while (true) {
+            auto pos = rest.find('\t');
+            fields.push_back(rest.substr(0, pos));
+            if (pos == std::string_view::npos) {
+                break;
+            }
+            rest.remove_prefix(pos + 1);
+        }
+        // A line cut short by a crash has fields missing at its end.
+        if (fields.size() < 2 || (fields.size() - 2) % 3 != 0 ||
+            fields[1].empty()) {
+            continue;
+        }
+        ZhuyinSentence sentence;
+        sentence.input = fields[1];
+        bool valid = true;
+        for (size_t i = 2; i < fields.size(); i += 3) {
+            ZhuyinChoice choice;
+            choice.text = fields[i + 2];
+            if (!parseOffset(fields[i], &choice.begin) ||
+                !parseOffset(fields[i + 1], &choice.end) ||
+                choice.begin >= choice.end ||
+                choice.end > sentence.input.size()) {
+                valid = false;
+                break;
+            }
+            sentence.choices.push_back(std::move(choice));
+        }
+        if (!valid) {
+            continue;
+        }
+        std::string profile(fields[0]);
+        if (result.empty() || result.back().first != profile) {
+            result.emplace_back(std::move(profile),
+                                std::vector<ZhuyinSentence>());
+        }
+        result.back().second.push_back(std::move(sentence));
+    }
+    return result;
+}
+
+void removeUntrained(const std::string &userDir) {
+    std::error_code ec;
+    std::filesystem::remove(std::filesystem::path(userDir) / untrainedFile,
+                            ec);
+}
+
+} // namespace fcitx
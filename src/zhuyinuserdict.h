@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_ZHUYIN_ZHUYINUSERDICT_H_
+#define _FCITX5_ZHUYIN_ZHUYINUSERDICT_H_
+
+#include "zhuyinsection.h"
+#include <cstddef>
+#include <cstdint>
+#include <fcitx-utils/misc.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include <zhuyin.h>
+
+namespace fcitx {
+
+// Which learned phrases are kept by compaction.
+struct ZhuyinCompactPolicy {
+    // Phrases used fewer times than this are dropped.
+    int minCount = 1;
+    // Keep at most this many phrases, the most frequently used first.
+    size_t maxPhrases = 20000;
+};
+
+struct ZhuyinCompactResult {
+    bool success = false;
+    size_t phrasesBefore = 0;
+    size_t phrasesAfter = 0;
+    // Size of user.bin and user_bigram.db in bytes.
+    int64_t sizeBefore = 0;
+    int64_t sizeAfter = 0;
+    // Time of zhuyin_load_phrase_library and zhuyin_save in usec.
+    uint64_t loadBefore = 0;
+    uint64_t loadAfter = 0;
+    uint64_t saveBefore = 0;
+    uint64_t saveAfter = 0;
+    // Loaded from the compacted files with user dictionary, it may be moved
+    // to another thread once compaction returns.
+    UniqueCPtr<zhuyin_context_t, zhuyin_fini> context;
+
+    std::string toString() const;
+};
+
+// Size of the files that grow with learned phrases, in bytes.
+int64_t userDictionarySize(const std::string &userDir);
+
+// Rewrite the user dictionary under userDir with only the phrases selected
+// by policy, the bigram of kept phrases is left as is. It uses a context of its own and can run on any thread, but
+// nothing else may save to userDir meanwhile, and existing contexts need to
+// be initialized again afterwards.
+ZhuyinCompactResult compactUserDictionary(const std::string &systemDir,
+                                          const std::string &userDir,
+                                          const ZhuyinCompactPolicy &policy);
+
+// Sentences committed during compaction, with the profile they are typed
+// in.
+using ZhuyinUntrained =
+    std::vector<std::pair<std::string, std::vector<ZhuyinSentence>>>;
+
+// Append sentences to the untrained file under userDir, so they are not lost
+// if fcitx exits before they are trained into the compacted dictionary.
+bool appendUntrained(const std::string &userDir, const std::string &profile,
+                     const std::vector<ZhuyinSentence> &sentences);
+// Read back what appendUntrained wrote, lines that can not be parsed are
+// skipped.
+ZhuyinUntrained loadUntrained(const std::string &userDir);
+// Remove the untrained file, once its sentences are saved to user dictionary.
+void removeUntrained(const std::string &userDir);
+
+} // namespace fcitx
+
+#endif // _FCITX5_ZHUYIN_ZHUYINUSERDICT_H_
@@ -0,0 +1,83 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "zhuyinwatchdog.h"
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <fcitx-utils/event.h>
+#include <sstream>
+#include <string>
+
+namespace fcitx {
+
+namespace {
+
+thread_local ZhuyinWatchdog *currentWatchdog = nullptr;
+
+constexpr const char *phaseNames[] = {"parse", "guess", "candidate", "train",
+                                      "ui"};
+
+} // namespace
+
+ZhuyinWatchdog::ZhuyinWatchdog(uint64_t threshold) : threshold_(threshold) {
+    if (!threshold_) {
+        return;
+    }
+    start_ = now(CLOCK_MONOTONIC);
+    parent_ = currentWatchdog;
+    currentWatchdog = this;
+}
+
+ZhuyinWatchdog::~ZhuyinWatchdog() {
+    if (!threshold_) {
+        return;
+    }
+    currentWatchdog = parent_;
+    // A nested operation is also a part of the outer one.
+    if (parent_) {
+        for (size_t i = 0; i < phases_.size(); i++) {
+            parent_->phases_[i] += phases_[i];
+        }
+    }
+}
+
+uint64_t ZhuyinWatchdog::elapsed() const {
+    return threshold_ ? now(CLOCK_MONOTONIC) - start_ : 0;
+}
+
+bool ZhuyinWatchdog::expired() const {
+    return threshold_ && elapsed() > threshold_;
+}
+
+std::string ZhuyinWatchdog::phases() const {
+    std::stringstream sstream;
+    for (size_t i = 0; i < phases_.size(); i++) {
+        if (i) {
+            sstream << " ";
+        }
+        sstream << phaseNames[i] << "=" << phases_[i] << "us";
+    }
+    return sstream.str();
+}
+
+ZhuyinWatchdog *ZhuyinWatchdog::current() { return currentWatchdog; }
+
+ZhuyinPhaseTimer::ZhuyinPhaseTimer(ZhuyinPhase phase)
+    : watchdog_(currentWatchdog), phase_(phase) {
+    if (watchdog_) {
+        start_ = now(CLOCK_MONOTONIC);
+    }
+}
+
+ZhuyinPhaseTimer::~ZhuyinPhaseTimer() {
+    if (watchdog_) {
+        watchdog_->phases_[static_cast<size_t>(phase_)] +=
+            now(CLOCK_MONOTONIC) - start_;
+    }
+}
+
+} // namespace fcitx
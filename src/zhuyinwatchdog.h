@@ -0,0 +1,71 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_ZHUYIN_ZHUYINWATCHDOG_H_
+#define _FCITX5_ZHUYIN_ZHUYINWATCHDOG_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace fcitx {
+
+enum class ZhuyinPhase { Parse, Guess, Candidate, Train, UI };
+
+// Measure an operation and the phases inside it, on the current thread.
+//
+// A disabled watchdog does not read the clock at all, and an enabled one
+// reads it once at each end plus twice for each phase. Details are only
+// formatted when the caller finds it expired.
+class ZhuyinWatchdog {
+public:
+    // Threshold is in usec, 0 disables the watchdog.
+    explicit ZhuyinWatchdog(uint64_t threshold);
+    ~ZhuyinWatchdog();
+
+    ZhuyinWatchdog(const ZhuyinWatchdog &) = delete;
+    ZhuyinWatchdog &operator=(const ZhuyinWatchdog &) = delete;
+
+    // Whether the operation has taken longer than threshold so far.
+    bool expired() const;
+    uint64_t elapsed() const;
+    uint64_t phase(ZhuyinPhase phase) const {
+        return phases_[static_cast<size_t>(phase)];
+    }
+    // e.g. "parse=120us guess=4000us candidate=0us train=0us ui=30us".
+    std::string phases() const;
+
+    // The innermost enabled watchdog of this thread, or nullptr.
+    static ZhuyinWatchdog *current();
+
+private:
+    friend class ZhuyinPhaseTimer;
+
+    uint64_t threshold_;
+    uint64_t start_ = 0;
+    std::array<uint64_t, 5> phases_{};
+    ZhuyinWatchdog *parent_ = nullptr;
+};
+
+// Add the lifetime of this object to a phase of current watchdog.
+class ZhuyinPhaseTimer {
+public:
+    explicit ZhuyinPhaseTimer(ZhuyinPhase phase);
+    ~ZhuyinPhaseTimer();
+
+    ZhuyinPhaseTimer(const ZhuyinPhaseTimer &) = delete;
+    ZhuyinPhaseTimer &operator=(const ZhuyinPhaseTimer &) = delete;
+
+private:
+    ZhuyinWatchdog *watchdog_;
+    ZhuyinPhase phase_;
+    uint64_t start_ = 0;
+};
+
+} // namespace fcitx
+
+#endif // _FCITX5_ZHUYIN_ZHUYINWATCHDOG_H_
@@ -0,0 +1,168 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "testdir.h"
+#include "zhuyinbuffer.h"
+#include "zhuyinoptions.h"
+#include "zhuyintestutils.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <fcitx-utils/misc.h>
+#include <fcitx-utils/stringutils.h>
+#include <fcitx-utils/utf8.h>
+#include <filesystem>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <zhuyin.h>
+
+using namespace fcitx;
+
+namespace {
+
+// Resident memory of this process in kB.
+long residentMemory() {
+    std::ifstream in("/proc/self/status");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (stringutils::startsWith(line, "VmRSS:")) {
+            return std::atol(line.data() + 6);
+        }
+    }
+    return 0;
+}
+
+std::string databaseFormat(const std::string &dataDir) {
+    std::ifstream in(dataDir + "/table.conf");
+    std::string line;
+    constexpr std::string_view prefix = "database format:";
+    while (std::getline(in, line)) {
+        if (stringutils::startsWith(line, prefix)) {
+            return line.substr(prefix.size());
+        }
+    }
+    return "unknown";
+}
+
+struct BenchResult {
+    double startup = 0;
+    double keyP50 = 0;
+    double keyP99 = 0;
+    double save = 0;
+    long rss = 0;
+};
+
+bool bench(const std::string &dataDir, const std::vector<std::string> &keys,
+           size_t rounds, BenchResult &result) {
+    char userDirTemplate[] = "/tmp/benchzhuyinXXXXXX";
+    if (!mkdtemp(userDirTemplate)) {
+        return false;
+    }
+    const std::string userDir = userDirTemplate;
+
+    const auto rss = residentMemory();
+    Timer startup;
+    UniqueCPtr<zhuyin_context_t, zhuyin_fini> context(
+        zhuyin_init(dataDir.data(), userDir.data()));
+    if (context) {
+        zhuyin_load_phrase_library(context.get(), USER_DICTIONARY);
+        result.startup = startup.elapsed();
+        result.rss = residentMemory() - rss;
+
+        ZhuyinContextOptions options;
+        options.options |= FORCE_TONE;
+        options.apply(context.get());
+        TestZhuyinProvider provider(context.get());
+        ZhuyinBuffer buffer(&provider);
+        // Every key parses and guesses the whole section.
+        std::vector<double> latency;
+        for (size_t i = 0; i < rounds; i++) {
+            for (const auto &sentence : keys) {
+                buffer.reset();
+                for (auto c : utf8::MakeUTF8CharRange(sentence)) {
+                    Timer timer;
+                    buffer.type(c);
+                    latency.push_back(timer.elapsed());
+                }
+                buffer.learn();
+            }
+        }
+        buffer.reset();
+        result.keyP50 = percentile(latency, 0.5);
+        result.keyP99 = percentile(latency, 0.99);
+
+        Timer save;
+        zhuyin_save(context.get());
+        result.save = save.elapsed();
+    }
+    context.reset();
+    std::filesystem::remove_all(userDir);
+    return result.startup > 0;
+}
+
+void usage(const char *argv0) {
+    std::cout << "Usage: " << argv0
+              << " [-c <corpus>] [-r <rounds>] [<data dir>...]\n"
+              << "Measure startup, key latency, save time and memory of the "
+                 "model in every data dir.\n\n"
+              << "-c: corpus file, key sequence is the first column\n"
+              << "-r: number of times the corpus is typed\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::string corpus = TESTING_SOURCE_DIR "/test/corpus.txt";
+    size_t rounds = 5;
+    int c;
+    while ((c = getopt(argc, argv, "c:r:h")) != -1) {
+        switch (c) {
+        case 'c':
+            corpus = optarg;
+            break;
+        case 'r':
+            rounds = std::max(1, std::atoi(optarg));
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    std::vector<std::string> dataDirs(argv + optind, argv + argc);
+    if (dataDirs.empty()) {
+        dataDirs.push_back(TESTING_BINARY_DIR "/data");
+    }
+    const auto keys = loadCorpusKeys(corpus);
+    if (keys.empty()) {
+        std::cerr << "Failed to load " << corpus << '\n';
+        return 1;
+    }
+
+    bool failed = false;
+    std::cout << "format\tstartup_us\tkey_p50_us\tkey_p99_us\tsave_us"
+                 "\trss_kb\tdata_dir\n";
+    for (const auto &dataDir : dataDirs) {
+        BenchResult result;
+        const auto format = databaseFormat(dataDir);
+        // libzhuyin only opens the format it is built with.
+        if (!bench(dataDir, keys, rounds, result)) {
+            std::cout << format << "\tunsupported\t\t\t\t\t" << dataDir
+                      << std::endl;
+            failed = true;
+            continue;
+        }
+        std::cout << format << '\t' << result.startup << '\t' << result.keyP50
+                  << '\t' << result.keyP99 << '\t' << result.save << '\t'
+                  << result.rss << '\t' << dataDir << std::endl;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,301 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "testdir.h"
+#include "zhuyinbuffer.h"
+#include "zhuyincandidate.h"
+#include "zhuyinoptions.h"
+#include "zhuyintestutils.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fcitx-utils/stringutils.h>
+#include <fcitx-utils/utf8.h>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <zhuyin.h>
+
+using namespace fcitx;
+
+namespace {
+
+struct FuzzyName {
+    const char *name;
+    pinyin_option_t option;
+};
+
+constexpr FuzzyName fuzzyNames[] = {
+    {"CCh", PINYIN_AMB_C_CH},     {"SSh", PINYIN_AMB_S_SH},
+    {"ZZh", PINYIN_AMB_Z_ZH},     {"FH", PINYIN_AMB_F_H},
+    {"GK", PINYIN_AMB_G_K},       {"LN", PINYIN_AMB_L_N},
+    {"LR", PINYIN_AMB_L_R},       {"AnAng", PINYIN_AMB_AN_ANG},
+    {"EnEng", PINYIN_AMB_EN_ENG}, {"InIng", PINYIN_AMB_IN_ING},
+};
+
+struct Result {
+    size_t sentences = 0;
+    size_t exactSentences = 0;
+    size_t characters = 0;
+    size_t errors = 0;
+    size_t keys = 0;
+    size_t selections = 0;
+    size_t unresolved = 0;
+    // Latency to type a whole sentence, in microseconds.
+    std::vector<double> latency;
+};
+
+std::u32string toUCS4(std::string_view str) {
+    std::u32string result;
+    for (auto c : utf8::MakeUTF8CharRange(str)) {
+        result.push_back(c);
+    }
+    return result;
+}
+
+size_t editDistance(const std::u32string &a, const std::u32string &b) {
+    std::vector<size_t> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++) {
+        row[j] = j;
+    }
+    for (size_t i = 1; i <= a.size(); i++) {
+        size_t diagonal = row[0];
+        row[0] = i;
+        for (size_t j = 1; j <= b.size(); j++) {
+            size_t up = row[j];
+            row[j] = std::min({row[j] + 1, row[j - 1] + 1,
+                               diagonal + (a[i - 1] == b[j - 1] ? 0 : 1)});
+            diagonal = up;
+        }
+    }
+    return row[b.size()];
+}
+
+// Pick candidates like a user would, until the text is the same as expected.
+// Return false if no candidate can fix the text.
+bool fixSentence(ZhuyinBuffer &buffer, const std::u32string &expected,
+                 size_t &selections) {
+    for (size_t round = 0; round <= expected.size(); round++) {
+        auto current = toUCS4(buffer.text());
+        if (current == expected) {
+            return true;
+        }
+        auto mismatch = std::mismatch(current.begin(), current.end(),
+                                      expected.begin(), expected.end());
+        size_t offset = std::distance(current.begin(), mismatch.first);
+        if (offset >= expected.size()) {
+            return false;
+        }
+
+        buffer.moveCursorToBeginning();
+        for (size_t i = 0; i < offset; i++) {
+            buffer.moveCursorRight();
+        }
+        std::vector<std::unique_ptr<ZhuyinCandidate>> candidates;
+        buffer.showCandidate(
+            [&candidates](std::unique_ptr<ZhuyinCandidate> candidate) {
+                candidates.push_back(std::move(candidate));
+            });
+
+        const ZhuyinCandidate *best = nullptr;
+        size_t bestLength = 0;
+        for (const auto &candidate : candidates) {
+            auto text = toUCS4(candidate->text().toString());
+            if (text.size() > bestLength &&
+                expected.compare(offset, text.size(), text) == 0) {
+                best = candidate.get();
+                bestLength = text.size();
+            }
+        }
+        if (!best) {
+            return false;
+        }
+        best->select(nullptr);
+        selections += 1;
+    }
+    return false;
+}
+
+void evaluate(ZhuyinBuffer &buffer, const std::string &keys,
+              const std::string &expected, Result &result) {
+    auto expectedChars = toUCS4(expected);
+    buffer.reset();
+    size_t count = 0;
+    Timer timer;
+    for (auto c : utf8::MakeUTF8CharRange(keys)) {
+        buffer.type(c);
+        count += 1;
+    }
+    auto text = buffer.text();
+    const auto elapsed = timer.elapsed();
+
+    auto textChars = toUCS4(text);
+    result.sentences += 1;
+    result.keys += count;
+    result.characters += expectedChars.size();
+    result.errors += editDistance(textChars, expectedChars);
+    result.latency.push_back(elapsed);
+    if (textChars == expectedChars) {
+        result.exactSentences += 1;
+    } else if (!fixSentence(buffer, expectedChars, result.selections)) {
+        result.unresolved += 1;
+    }
+}
+
+std::string escapeJson(std::string_view str) {
+    std::string result;
+    for (auto c : str) {
+        if (c == '"' || c == '\\') {
+            result.push_back('\\');
+        }
+        result.push_back(c);
+    }
+    return result;
+}
+
+void usage(const char *argv0) {
+    std::cout << "Usage: " << argv0
+              << " [-l <layout>] [-T] [-f <fuzzy>] [-d <datadir>] [-J]"
+              << " <corpus>\n"
+              << "Each line of corpus is key sequence and expected text "
+                 "separated by tab.\n\n"
+              << "-l: layout name, same as the configuration\n"
+              << "-T: do not require tone in zhuyin\n"
+              << "-f: comma separated fuzzy pairs, e.g. CCh,AnAng\n"
+              << "-d: directory that contains table.conf\n"
+              << "-J: print result as json\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::string dataDir = TESTING_BINARY_DIR "/data";
+    std::string layout = "Standard";
+    std::string fuzzy;
+    bool needTone = true;
+    bool json = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "l:Tf:d:Jh")) != -1) {
+        switch (c) {
+        case 'l':
+            layout = optarg;
+            break;
+        case 'T':
+            needTone = false;
+            break;
+        case 'f':
+            fuzzy = optarg;
+            break;
+        case 'd':
+            dataDir = optarg;
+            break;
+        case 'J':
+            json = true;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ZhuyinContextOptions options;
+    if (!options.setLayout(layout)) {
+        std::cerr << "Unknown layout: " << layout << '\n';
+        return 1;
+    }
+    if (options.isZhuyin && needTone) {
+        options.options |= FORCE_TONE;
+    }
+    for (const auto &name : stringutils::split(fuzzy, ",")) {
+        auto iter = std::find_if(
+            std::begin(fuzzyNames), std::end(fuzzyNames),
+            [&name](const FuzzyName &item) { return name == item.name; });
+        if (iter == std::end(fuzzyNames)) {
+            std::cerr << "Unknown fuzzy pair: " << name << '\n';
+            return 1;
+        }
+        options.options |= iter->option;
+    }
+
+    const auto corpus = loadCorpus(argv[optind]);
+    if (corpus.empty()) {
+        std::cerr << "Failed to load " << argv[optind] << '\n';
+        return 1;
+    }
+
+    TestZhuyinProvider provider(options, dataDir);
+    if (!provider.context()) {
+        std::cerr << "Failed to load model from " << dataDir << '\n';
+        return 1;
+    }
+    ZhuyinBuffer buffer(&provider);
+
+    Result result;
+    for (const auto &entry : corpus) {
+        evaluate(buffer, entry.keys, entry.text, result);
+    }
+
+    auto latency = result.latency;
+    std::sort(latency.begin(), latency.end());
+    double total = 0;
+    for (auto value : latency) {
+        total += value;
+    }
+    const double characterAccuracy =
+        result.characters
+            ? 1.0 - static_cast<double>(result.errors) / result.characters
+            : 0;
+    const double sentenceAccuracy =
+        result.sentences
+            ? static_cast<double>(result.exactSentences) / result.sentences
+            : 0;
+    const double keysPerSecond = total > 0 ? result.keys / total * 1e6 : 0;
+
+    if (json) {
+        std::cout << "{\"corpus\":\"" << escapeJson(argv[optind])
+                  << "\",\"dataDir\":\"" << escapeJson(dataDir)
+                  << "\",\"layout\":\"" << escapeJson(layout)
+                  << "\",\"needTone\":" << (needTone ? "true" : "false")
+                  << ",\"fuzzy\":\"" << escapeJson(fuzzy)
+                  << "\",\"sentences\":" << result.sentences
+                  << ",\"characters\":" << result.characters
+                  << ",\"characterAccuracy\":" << characterAccuracy
+                  << ",\"sentenceAccuracy\":" << sentenceAccuracy
+                  << ",\"selections\":" << result.selections
+                  << ",\"unresolved\":" << result.unresolved
+                  << ",\"keys\":" << result.keys
+                  << ",\"keysPerSecond\":" << keysPerSecond
+                  << ",\"latencyUs\":{\"p50\":" << percentile(latency, 0.5)
+                  << ",\"p90\":" << percentile(latency, 0.9)
+                  << ",\"p99\":" << percentile(latency, 0.99) << ",\"max\":"
+                  << (latency.empty() ? 0 : latency.back()) << "}}\n";
+    } else {
+        std::cout << "Sentences: " << result.sentences << '\n'
+                  << "Character accuracy: " << characterAccuracy << '\n'
+                  << "Sentence accuracy: " << sentenceAccuracy << '\n'
+                  << "Candidate selections: " << result.selections
+                  << " (unresolved sentences: " << result.unresolved << ")\n"
+                  << "Keys per second: " << keysPerSecond << '\n'
+                  << "Sentence latency (us): p50 "
+                  << percentile(latency, 0.5) << ", p90 "
+                  << percentile(latency, 0.9) << ", p99 "
+                  << percentile(latency, 0.99) << ", max "
+                  << (latency.empty() ? 0 : latency.back()) << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "testdir.h"
+#include "testfrontend_public.h"
+#include "zhuyintestutils.h"
+#include <algorithm>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/misc.h>
+#include <fcitx-utils/standardpaths.h>
+#include <fcitx-utils/stringutils.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx-utils/utf8.h>
+#include <fcitx/addoninstance.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/inputcontext.h>
+#include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodgroup.h>
+#include <fcitx/inputmethodmanager.h>
+#include <fcitx/instance.h>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include <zhuyin.h>
+
+using namespace fcitx;
+
+namespace {
+
+struct LoadOptions {
+    size_t maxContexts = 200;
+    size_t step = 50;
+    size_t rounds = 200;
+    // Reload config every reloadInterval rounds.
+    size_t reloadInterval = 50;
+    std::string corpus = TESTING_SOURCE_DIR "/test/corpus.txt";
+    // Number of separate processes that load the model, 0 to run the input
+    // context load test instead.
+    size_t sessions = 0;
+};
+
+long peakRSS() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_maxrss;
+}
+
+void runLoadTest(Instance *instance, const LoadOptions &options) {
+    auto *zhuyin = instance->addonManager().addon("zhuyin", true);
+    FCITX_ASSERT(zhuyin);
+    auto *testfrontend = instance->addonManager().addon("testfrontend");
+    FCITX_ASSERT(testfrontend);
+
+    auto defaultGroup = instance->inputMethodManager().currentGroup();
+    defaultGroup.inputMethodList().clear();
+    defaultGroup.inputMethodList().push_back(
+        InputMethodGroupItem("keyboard-us"));
+    defaultGroup.inputMethodList().push_back(InputMethodGroupItem("zhuyin"));
+    defaultGroup.setDefaultInputMethod("");
+    instance->inputMethodManager().setGroup(defaultGroup);
+
+    auto corpus = loadCorpusKeys(options.corpus);
+    FCITX_ASSERT(!corpus.empty()) << "Failed to load " << options.corpus;
+
+    std::mt19937 random(0);
+    std::vector<ICUUID> contexts;
+    InputContext *focused = nullptr;
+
+    std::cout << "contexts\tkeys\tkey_p50_us\tkey_p99_us\tkey_max_us"
+                 "\treload_us\tpeak_rss_kb\n";
+    for (size_t target = std::min(options.step, options.maxContexts);
+         target <= options.maxContexts; target += options.step) {
+        while (contexts.size() < target) {
+            auto uuid = testfrontend->call<ITestFrontend::createInputContext>(
+                "loadzhuyin");
+            auto *ic = instance->inputContextManager().findByUUID(uuid);
+            FCITX_ASSERT(ic);
+            ic->focusIn();
+            // Switch to zhuyin.
+            testfrontend->call<ITestFrontend::keyEvent>(
+                uuid, Key("Control+space"), false);
+            ic->focusOut();
+            contexts.push_back(uuid);
+        }
+
+        std::vector<double> keyLatency;
+        std::vector<double> reloadLatency;
+        for (size_t round = 0; round < options.rounds; round++) {
+            const auto &uuid = contexts[random() % contexts.size()];
+            auto *ic = instance->inputContextManager().findByUUID(uuid);
+            if (focused != ic) {
+                if (focused) {
+                    focused->focusOut();
+                }
+                ic->focusIn();
+                focused = ic;
+            }
+
+            const auto &keys = corpus[random() % corpus.size()];
+            for (auto c : utf8::MakeUTF8CharRange(keys)) {
+                Timer timer;
+                testfrontend->call<ITestFrontend::keyEvent>(
+                    uuid, Key(Key::keySymFromUnicode(c)), false);
+                keyLatency.push_back(timer.elapsed());
+            }
+            Timer timer;
+            testfrontend->call<ITestFrontend::keyEvent>(
+                uuid, Key(FcitxKey_Return), false);
+            keyLatency.push_back(timer.elapsed());
+
+            if (options.reloadInterval &&
+                (round + 1) % options.reloadInterval == 0) {
+                Timer timer;
+                zhuyin->reloadConfig();
+                reloadLatency.push_back(timer.elapsed());
+            }
+        }
+
+        std::cout << contexts.size() << '\t' << keyLatency.size() << '\t'
+                  << percentile(keyLatency, 0.5) << '\t'
+                  << percentile(keyLatency, 0.99) << '\t'
+                  << percentile(keyLatency, 1) << '\t'
+                  << percentile(reloadLatency, 0.5) << '\t' << peakRSS()
+                  << std::endl;
+    }
+}
+
+struct MemoryUsage {
+    long rss = 0;
+    long pss = 0;
+    long privateSize = 0;
+};
+
+// Values are in kB, read from /proc/<pid>/smaps_rollup.
+MemoryUsage memoryUsage(pid_t pid) {
+    MemoryUsage usage;
+    std::ifstream in(stringutils::concat("/proc/", pid, "/smaps_rollup"));
+    std::string line;
+    while (std::getline(in, line)) {
+        auto tokens = stringutils::split(line, FCITX_WHITESPACE);
+        if (tokens.size() < 2) {
+            continue;
+        }
+        auto value = std::atol(tokens[1].data());
+        if (tokens[0] == "Rss:") {
+            usage.rss = value;
+        } else if (tokens[0] == "Pss:") {
+            usage.pss = value;
+        } else if (tokens[0] == "Private_Clean:" ||
+                   tokens[0] == "Private_Dirty:") {
+            usage.privateSize += value;
+        }
+    }
+    return usage;
+}
+
+// Fork processes that hold a zhuyin context each, like one fcitx per user
+// session, and report how much memory every one of them costs. The first
+// process does not load the model and serves as the baseline.
+int runSessions(size_t sessions) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return 1;
+    }
+    std::vector<pid_t> children;
+    for (size_t i = 0; i <= sessions; i++) {
+        auto pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            UniqueCPtr<zhuyin_context_t, zhuyin_fini> context;
+            if (i != 0) {
+                context.reset(
+                    zhuyin_init(TESTING_BINARY_DIR "/data", "/Invalid/Path"));
+            }
+            char ready = context || i == 0 ? 'y' : 'n';
+            if (write(fds[1], &ready, 1) != 1) {
+                _exit(1);
+            }
+            pause();
+            _exit(0);
+        }
+        if (pid < 0) {
+            break;
+        }
+        children.push_back(pid);
+    }
+    close(fds[1]);
+    bool failed = children.size() != sessions + 1;
+    for (size_t i = 0; i < children.size(); i++) {
+        char ready = 'n';
+        if (read(fds[0], &ready, 1) != 1 || ready != 'y') {
+            failed = true;
+        }
+    }
+    close(fds[0]);
+
+    std::vector<MemoryUsage> usages;
+    for (auto pid : children) {
+        usages.push_back(memoryUsage(pid));
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+    if (failed || usages.size() < 2) {
+        std::cerr << "Failed to start sessions.\n";
+        return 1;
+    }
+
+    MemoryUsage total;
+    for (size_t i = 1; i < usages.size(); i++) {
+        total.rss += usages[i].rss - usages[0].rss;
+        total.pss += usages[i].pss - usages[0].pss;
+        total.privateSize += usages[i].privateSize - usages[0].privateSize;
+    }
+    const auto n = static_cast<long>(usages.size() - 1);
+    std::cout << "sessions\tmodel_rss_kb\tmodel_pss_kb\tmodel_private_kb\n"
+              << n << '\t' << total.rss / n << '\t' << total.pss / n << '\t'
+              << total.privateSize / n << std::endl;
+    return 0;
+}
+
+void usage(const char *argv0) {
+    std::cout << "Usage: " << argv0
+              << " [-n <contexts>] [-s <step>] [-r <rounds>] [-R <interval>]"
+              << " [-c <corpus>] [-p <sessions>]\n"
+              << "-n: maximum number of input contexts\n"
+              << "-s: number of input contexts added in every step\n"
+              << "-r: number of sentences typed in every step\n"
+              << "-R: reload config every given sentences, 0 to disable\n"
+              << "-c: corpus file, key sequence is the first column\n"
+              << "-p: only measure memory of processes that load the model\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    LoadOptions options;
+    int c;
+    while ((c = getopt(argc, argv, "n:s:r:R:c:p:h")) != -1) {
+        switch (c) {
+        case 'n':
+            options.maxContexts = std::atoi(optarg);
+            break;
+        case 's':
+            options.step = std::max(1, std::atoi(optarg));
+            break;
+        case 'r':
+            options.rounds = std::atoi(optarg);
+            break;
+        case 'R':
+            options.reloadInterval = std::atoi(optarg);
+            break;
+        case 'c':
+            options.corpus = optarg;
+            break;
+        case 'p':
+            options.sessions = std::atoi(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.sessions) {
+        return runSessions(options.sessions);
+    }
+
+    setupTestingEnvironment(
+        TESTING_BINARY_DIR, {TESTING_BINARY_DIR "/bin"},
+        {TESTING_BINARY_DIR "/test",
+         StandardPaths::fcitxPath("pkgdatadir", "testing").string()});
+    // Commit of every sentence is logged by testfrontend at info level.
+    Log::setLogRule("default=3");
+
+    char arg0[] = "loadzhuyin";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,testfrontend,zhuyin";
+    char *instanceArgv[] = {arg0, arg1, arg2};
+    Instance instance(FCITX_ARRAY_SIZE(instanceArgv), instanceArgv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+    EventDispatcher dispatcher;
+    dispatcher.attach(&instance.eventLoop());
+    dispatcher.schedule([&dispatcher, &instance, &options]() {
+        runLoadTest(&instance, options);
+        dispatcher.detach();
+        instance.exit();
+    });
+    instance.exec();
+    return 0;
+}
@@ -0,0 +1,322 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "zhuyinarena.h"
+#include "zhuyinbuffer.h"
+#include "zhuyincandidate.h"
+#include "zhuyintestutils.h"
+#include <cstddef>
+#include <cstdlib>
+#include <fcitx-utils/misc.h>
+#include <fcitx-utils/utf8.h>
+#include <fcitx/text.h>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include <zhuyin.h>
+
+#ifdef __GLIBC__
+
+// Replace the allocator of the whole process, so allocations from libzhuyin
+// and glib are counted as well. operator new is routed to glibc directly, so
+// malloc only sees C allocations, which are mostly glib.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+namespace {
+
+struct AllocStats {
+    size_t cxxAllocs = 0;
+    size_t cAllocs = 0;
+    size_t frees = 0;
+    size_t bytes = 0;
+};
+
+bool counting = false;
+AllocStats stats;
+
+void countC(size_t size) {
+    if (counting) {
+        stats.cAllocs += 1;
+        stats.bytes += size;
+    }
+}
+
+void countCxx(size_t size) {
+    if (counting) {
+        stats.cxxAllocs += 1;
+        stats.bytes += size;
+    }
+}
+
+void countFree(void *ptr) {
+    if (counting && ptr) {
+        stats.frees += 1;
+    }
+}
+
+void *newImpl(size_t size) {
+    countCxx(size);
+    if (void *ptr = __libc_malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+} // namespace
+
+extern "C" {
+void *malloc(size_t size) {
+    countC(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    countC(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    countC(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    countFree(ptr);
+    __libc_free(ptr);
+}
+}
+
+void *operator new(size_t size) { return newImpl(size); }
+void *operator new[](size_t size) { return newImpl(size); }
+void operator delete(void *ptr) noexcept {
+    countFree(ptr);
+    __libc_free(ptr);
+}
+void operator delete[](void *ptr) noexcept {
+    countFree(ptr);
+    __libc_free(ptr);
+}
+void operator delete(void *ptr, size_t) noexcept {
+    countFree(ptr);
+    __libc_free(ptr);
+}
+void operator delete[](void *ptr, size_t) noexcept {
+    countFree(ptr);
+    __libc_free(ptr);
+}
+
+using namespace fcitx;
+
+namespace {
+
+class AllocScope {
+public:
+    AllocScope() {
+        stats = AllocStats();
+        counting = true;
+    }
+    ~AllocScope() { counting = false; }
+
+    AllocStats result() const { return stats; }
+};
+
+struct Scenario {
+    std::string name;
+    size_t ops;
+    AllocStats stats;
+};
+
+// Allocation counts depend on libzhuyin, glib and the model, so reading the
+// buffer is checked against a reference measured in the same run: the same
+// libzhuyin calls on an instance of its own, and building the Text from the
+// result. What the buffer allocates on top of that is its own overhead.
+// Allow 10% and two allocations more.
+size_t margin(size_t reference) { return reference / 10 + 2; }
+
+size_t allocsPerOp(const Scenario &scenario) {
+    const auto allocs = scenario.stats.cxxAllocs + scenario.stats.cAllocs;
+    return (allocs + scenario.ops - 1) / scenario.ops;
+}
+
+void typeKeys(ZhuyinBuffer &buffer, const std::string &keys) {
+    for (auto c : utf8::MakeUTF8CharRange(keys)) {
+        buffer.type(c);
+    }
+}
+
+template <typename Callback>
+Scenario measure(const std::string &name, size_t ops, Callback callback) {
+    Scenario scenario{name, ops, {}};
+    {
+        AllocScope scope;
+        // Same as a key event handled by the engine.
+        ZhuyinArenaScope arena;
+        callback();
+        scenario.stats = scope.result();
+    }
+    return scenario;
+}
+
+// The least work to read a buffer holding keys, with the cursor at the end.
+class Reference {
+public:
+    Reference(zhuyin_context_t *context, const std::string &keys)
+        : instance_(zhuyin_alloc_instance(context)), size_(keys.size()) {
+        zhuyin_parse_more_chewings(instance_.get(), keys.data());
+        zhuyin_guess_sentence(instance_.get());
+    }
+
+    Text preedit() const {
+        char *sentence = nullptr;
+        zhuyin_get_sentence(instance_.get(), &sentence);
+        Text text;
+        text.setCursor(0);
+        text.append(std::string(sentence ? sentence : ""),
+                    TextFormatFlag::Underline);
+        free(sentence);
+        return text;
+    }
+    std::string text() const { return preedit().toStringForCommit(); }
+    // Offsets looked up by ZhuyinBuffer::moveCursorLeft and
+    // moveCursorRight.
+    void moveCursor() const {
+        size_t offset = 0;
+        size_t right = 0;
+        zhuyin_get_zhuyin_offset(instance_.get(), size_ - 1, &offset);
+        zhuyin_get_zhuyin_offset(instance_.get(), offset + 1, &offset);
+        zhuyin_get_right_zhuyin_offset(instance_.get(), offset, &right);
+    }
+
+private:
+    UniqueCPtr<zhuyin_instance_t, zhuyin_free_instance> instance_;
+    size_t size_;
+};
+
+std::vector<Scenario> measureReads(ZhuyinBuffer &buffer,
+                                   const Reference &reference,
+                                   const std::string &suffix, bool &ok) {
+    std::vector<Scenario> scenarios;
+    auto check = [&scenarios, &ok](Scenario scenario, Scenario expected) {
+        const auto perOp = allocsPerOp(scenario);
+        const auto limit = allocsPerOp(expected);
+        scenarios.push_back(std::move(expected));
+        scenarios.push_back(std::move(scenario));
+        if (perOp > limit + margin(limit)) {
+            std::cout << scenarios.back().name << ": " << perOp
+                      << " allocs/op exceeds reference " << limit << " + "
+                      << margin(limit) << '\n';
+            ok = false;
+        }
+    };
+    check(measure("preedit" + suffix, 1, [&]() { buffer.preedit(); }),
+          measure("reference-preedit" + suffix, 1,
+                  [&]() { reference.preedit(); }));
+    check(measure("text" + suffix, 1, [&]() { buffer.text(); }),
+          measure("reference-text" + suffix, 1,
+                  [&]() { reference.text(); }));
+    check(measure("move-cursor" + suffix, 2,
+                  [&]() {
+                      buffer.moveCursorLeft();
+                      buffer.moveCursorRight();
+                  }),
+          measure("reference-move-cursor" + suffix, 2,
+                  [&]() { reference.moveCursor(); }));
+    return scenarios;
+}
+
+bool runScenarios(std::vector<Scenario> &scenarios) {
+    TestZhuyinProvider provider;
+    ZhuyinBuffer buffer(&provider);
+    bool ok = true;
+    // 你好
+    const std::string shortKeys = "su3cl3";
+    // 今天天氣很好
+    const std::string longKeys = "rup wu0 wu0 fu4cp3cl3";
+    const Reference shortReference(provider.context(), shortKeys);
+    const Reference longReference(provider.context(), longKeys);
+
+    // Warm up, so one-off allocations in libzhuyin and the arena are not
+    // counted.
+    {
+        ZhuyinArenaScope arena;
+        typeKeys(buffer, longKeys);
+        buffer.preedit();
+        buffer.text();
+        shortReference.text();
+        longReference.text();
+    }
+    buffer.reset();
+
+    scenarios.push_back(measure("type-short", shortKeys.size(), [&]() {
+        typeKeys(buffer, shortKeys);
+    }));
+    for (auto &scenario : measureReads(buffer, shortReference, "", ok)) {
+        scenarios.push_back(std::move(scenario));
+    }
+    buffer.reset();
+    scenarios.push_back(measure("type-long", longKeys.size(),
+                                [&]() { typeKeys(buffer, longKeys); }));
+    for (auto &scenario : measureReads(buffer, longReference, "-long", ok)) {
+        scenarios.push_back(std::move(scenario));
+    }
+
+    std::vector<std::unique_ptr<ZhuyinCandidate>> candidates;
+    scenarios.push_back(measure("candidates", 1, [&]() {
+        buffer.showCandidate(
+            [&candidates](std::unique_ptr<ZhuyinCandidate> candidate) {
+                candidates.push_back(std::move(candidate));
+            });
+    }));
+    if (!candidates.empty()) {
+        scenarios.push_back(measure("select-candidate", 1, [&]() {
+            candidates.back()->select(nullptr);
+        }));
+    }
+    candidates.clear();
+
+    scenarios.push_back(measure("backspace", 3, [&]() {
+        buffer.backspace();
+        buffer.backspace();
+        buffer.backspace();
+    }));
+    return ok;
+}
+
+} // namespace
+
+int main() {
+    // Typing, candidates and backspace are only reported, most of their
+    // allocations are libzhuyin guessing the sentence.
+    std::vector<Scenario> scenarios;
+    const bool ok = runScenarios(scenarios);
+    for (const auto &scenario : scenarios) {
+        const auto &stats = scenario.stats;
+        std::cout << scenario.name << ": " << allocsPerOp(scenario)
+                  << " allocs/op (" << stats.cxxAllocs << " C++, "
+                  << stats.cAllocs << " C/glib, " << stats.frees
+                  << " frees, " << stats.bytes << " bytes over "
+                  << scenario.ops << " ops)\n";
+    }
+    return ok ? 0 : 1;
+}
+
+#else
+
+int main() {
+    // Allocator interposition relies on glibc.
+    std::cout << "Skipped, allocation counting requires glibc.\n";
+    return 0;
+}
+
+#endif
@@ -4,37 +4,19 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  *
  */
-#include "testdir.h"
 #include "zhuyinbuffer.h"
 #include "zhuyincandidate.h"
-#include "zhuyinsymbol.h"
+#include "zhuyintestutils.h"
+#include "zhuyinwatchdog.h"
 #include <fcitx-utils/log.h>
-#include <fcitx-utils/misc.h>
+#include <fcitx-utils/utf8.h>
 #include <memory>
-#include <zhuyin.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 using namespace fcitx;
 
-class TestZhuyinProvider : public ZhuyinProviderInterface {
-public:
-    TestZhuyinProvider() {
-        context_.reset(
-            zhuyin_init(TESTING_BINARY_DIR "/data", "/Invalid/Path"));
-        zhuyin_set_options(context_.get(), USE_TONE | ZHUYIN_CORRECT_ALL |
-                                               FORCE_TONE | DYNAMIC_ADJUST);
-        zhuyin_set_chewing_scheme(context_.get(), ZHUYIN_STANDARD);
-    }
-
-    zhuyin_context_t *context() override { return context_.get(); }
-
-    bool isZhuyin() const override { return true; }
-    const ZhuyinSymbol &symbol() const override { return symbol_; }
-
-private:
-    ZhuyinSymbol symbol_;
-    UniqueCPtr<zhuyin_context_t, zhuyin_fini> context_;
-};
-
 void test_basic() {
     TestZhuyinProvider provider;
     ZhuyinBuffer buffer(&provider);
@@ -167,8 +149,173 @@ void test_candidate() {
     buffer.showCandidate(printCandidate);
 }
 
+void test_split_merge() {
+    TestZhuyinProvider provider;
+    ZhuyinBuffer buffer(&provider);
+    for (auto c : std::string("zp zp zp ")) {
+        buffer.type(c);
+    }
+    buffer.moveCursorToBeginning();
+    buffer.moveCursorRight();
+    std::vector<std::unique_ptr<ZhuyinCandidate>> candidates;
+    buffer.showCandidate(
+        [&candidates](std::unique_ptr<ZhuyinCandidate> candidate) {
+            candidates.push_back(std::move(candidate));
+        });
+    // Pick a single character that is unlikely to be guessed.
+    for (auto iter = candidates.rbegin(); iter != candidates.rend(); ++iter) {
+        if (utf8::length((*iter)->text().toString()) == 1) {
+            (*iter)->select(nullptr);
+            break;
+        }
+    }
+    candidates.clear();
+    auto text = buffer.text();
+    FCITX_INFO() << buffer.dump();
+
+    // Split the section after the second character, and merge it back.
+    buffer.moveCursorToEnd();
+    buffer.moveCursorLeft();
+    buffer.type(0x263a);
+    FCITX_INFO() << buffer.dump();
+    buffer.backspace();
+    FCITX_INFO() << buffer.dump();
+    FCITX_ASSERT(buffer.text() == text) << buffer.text() << " " << text;
+
+    // What is needed to learn the buffer later, with the choice.
+    auto sentences = buffer.sentences();
+    FCITX_ASSERT(sentences.size() == 1);
+    FCITX_ASSERT(sentences[0].input == "zp zp zp ") << sentences[0].input;
+    FCITX_ASSERT(sentences[0].choices.size() == 1);
+    ZhuyinBuffer other(&provider);
+    other.learn(sentences);
+    FCITX_ASSERT(other.empty());
+}
+
+void test_edit_before_choice() {
+    TestZhuyinProvider provider;
+    ZhuyinBuffer buffer(&provider);
+    // 你好
+    for (auto c : std::string("su3cl3")) {
+        buffer.type(c);
+    }
+    buffer.moveCursorToBeginning();
+    std::vector<std::unique_ptr<ZhuyinCandidate>> candidates;
+    buffer.showCandidate(
+        [&candidates](std::unique_ptr<ZhuyinCandidate> candidate) {
+            candidates.push_back(std::move(candidate));
+        });
+    // Pick a single character that is unlikely to be guessed.
+    std::string chosen;
+    for (auto iter = candidates.rbegin(); iter != candidates.rend(); ++iter) {
+        if (utf8::length((*iter)->text().toString()) == 1) {
+            chosen = (*iter)->text().toString();
+            (*iter)->select(nullptr);
+            break;
+        }
+    }
+    candidates.clear();
+    FCITX_ASSERT(!chosen.empty());
+    auto text = buffer.text();
+    FCITX_INFO() << buffer.dump();
+    FCITX_ASSERT(text.compare(0, chosen.size(), chosen) == 0) << text;
+
+    // Type 今 before the choice, it moves with the input after it.
+    buffer.moveCursorToBeginning();
+    for (auto c : std::string("rup ")) {
+        buffer.type(c);
+    }
+    FCITX_INFO() << buffer.dump();
+    auto moved = buffer.text();
+    auto first = utf8::ncharByteLength(moved.data(), 1);
+    FCITX_ASSERT(moved.compare(first, chosen.size(), chosen) == 0) << moved;
+
+    for (int i = 0; i < 4; i++) {
+        buffer.backspace();
+    }
+    FCITX_INFO() << buffer.dump();
+    FCITX_ASSERT(buffer.text() == text) << buffer.text() << " " << text;
+}
+
+void test_watchdog() {
+    TestZhuyinProvider provider;
+    ZhuyinBuffer buffer(&provider);
+    FCITX_ASSERT(!ZhuyinWatchdog::current());
+    {
+        ZhuyinWatchdog disabled(0);
+        FCITX_ASSERT(!ZhuyinWatchdog::current());
+        FCITX_ASSERT(!disabled.expired());
+    }
+    {
+        ZhuyinWatchdog outer(1000000);
+        {
+            ZhuyinWatchdog inner(1000000);
+            FCITX_ASSERT(ZhuyinWatchdog::current() == &inner);
+            // 你好
+            for (auto c : std::string("su3cl3")) {
+                buffer.type(c);
+            }
+            buffer.learn();
+        }
+        FCITX_ASSERT(ZhuyinWatchdog::current() == &outer);
+        FCITX_INFO() << outer.phases();
+    }
+    FCITX_ASSERT(!ZhuyinWatchdog::current());
+
+    // Shape does not contain anything user typed.
+    auto shape = buffer.dumpShape();
+    FCITX_INFO() << shape;
+    FCITX_ASSERT(shape.find("su3") == std::string::npos);
+    FCITX_ASSERT(shape.find(buffer.text()) == std::string::npos);
+    FCITX_ASSERT(shape.find("<Zhuyin,Size:6,") != std::string::npos);
+}
+
+void test_guess_budget() {
+    TestZhuyinProvider provider;
+    // Every guess takes 10us by the clock of provider.
+    provider.setClockStep(10);
+    // Never exceeded, but keeps the guessed sentence.
+    provider.setGuessBudget(20);
+    ZhuyinBuffer buffer(&provider);
+    // 你好
+    for (auto c : std::string("su3")) {
+        buffer.type(c);
+    }
+    const auto first = buffer.text();
+    FCITX_ASSERT(!first.empty());
+
+    // The last guess took longer than this.
+    provider.setGuessBudget(5);
+    buffer.type('c');
+    buffer.type('l');
+    buffer.type('3');
+    FCITX_ASSERT(buffer.guessPending());
+    auto pending = buffer.preedit();
+    FCITX_INFO() << pending.toString();
+    FCITX_ASSERT(pending.toString() == first + "ㄏㄠˇ")
+        << pending.toString();
+    FCITX_ASSERT(pending.cursor() ==
+                 static_cast<int>(pending.toString().size()));
+    // Counted as converted, so a long pending section is not committed
+    // early for its symbols.
+    FCITX_ASSERT(buffer.preeditLength() == 2) << buffer.preeditLength();
+
+    FCITX_ASSERT(buffer.text() == "你好") << buffer.text();
+    FCITX_ASSERT(!buffer.guessPending());
+
+    // Candidates are always from the full guess.
+    buffer.type('s');
+    FCITX_ASSERT(buffer.guessPending());
+    buffer.showCandidate([](std::unique_ptr<ZhuyinCandidate>) {});
+    FCITX_ASSERT(!buffer.guessPending());
+}
+
 int main() {
     test_basic();
     test_candidate();
+    test_split_merge();
+    test_edit_before_choice();
+    test_watchdog();
+    test_guess_budget();
     return 0;
 }
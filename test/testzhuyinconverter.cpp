@@ -0,0 +1,131 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "zhuyinbuffer.h"
+#include "zhuyinconverter.h"
+#include "zhuyinsymbol.h"
+#include "zhuyintestutils.h"
+#include <cstddef>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/utf8.h>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+std::vector<std::string> loadKeys() {
+    auto keys = loadCorpusKeys(TESTING_SOURCE_DIR "/test/corpus.txt");
+    // 你好, 今天天氣很好
+    keys.push_back("su3cl3");
+    keys.push_back("rup wu0 wu0 fu4cp3cl3");
+    return keys;
+}
+
+std::string convertOnMainThread(ZhuyinBuffer &buffer,
+                                const std::string &keys) {
+    buffer.reset();
+    for (auto c : utf8::MakeUTF8CharRange(keys)) {
+        buffer.type(c);
+    }
+    auto text = buffer.text();
+    buffer.reset();
+    return text;
+}
+
+void test_concurrent() {
+    const auto keys = loadKeys();
+    TestZhuyinProvider provider;
+    ZhuyinBuffer buffer(&provider);
+    std::vector<std::string> expected;
+    for (const auto &key : keys) {
+        expected.push_back(convertOnMainThread(buffer, key));
+    }
+
+    ZhuyinConverter converter(TESTING_BINARY_DIR "/data", "/Invalid/Path", 4);
+    converter.publish(testContextOptions(), std::make_shared<ZhuyinSymbol>());
+
+    constexpr size_t rounds = 8;
+    std::vector<std::future<std::string>> results;
+    std::vector<size_t> indices;
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < keys.size(); i++) {
+            auto promise = std::make_shared<std::promise<std::string>>();
+            results.push_back(promise->get_future());
+            indices.push_back(i);
+            converter.convert(keys[i], [promise](std::string result) {
+                promise->set_value(std::move(result));
+            });
+        }
+        // Keep the main thread busy with its own context meanwhile.
+        FCITX_ASSERT(convertOnMainThread(buffer, keys[round % keys.size()]) ==
+                     expected[round % keys.size()]);
+        if (round == rounds / 4) {
+            // Workers reload user dictionary in the middle of the queue.
+            converter.publishUserDictionary();
+        } else if (round == rounds / 2) {
+            // And apply new options to the same context.
+            converter.publish(testContextOptions(),
+                              std::make_shared<ZhuyinSymbol>());
+        }
+    }
+    FCITX_ASSERT(converter.version() == 3);
+
+    for (size_t i = 0; i < results.size(); i++) {
+        auto result = results[i].get();
+        FCITX_ASSERT(result == expected[indices[i]])
+            << keys[indices[i]] << " " << result << " "
+            << expected[indices[i]];
+    }
+    FCITX_INFO() << "Converted " << results.size() << " sequences";
+}
+
+// A result converted with a snapshot that is replaced meanwhile must not be
+// delivered, the job is converted again with the new snapshot.
+void test_stale_result() {
+    const std::string keys = "ni3hao3";
+    const auto zhuyin = testContextOptions();
+    auto pinyin = testContextOptions();
+    FCITX_ASSERT(pinyin.setLayout("Hanyu"));
+    TestZhuyinProvider zhuyinProvider(zhuyin);
+    TestZhuyinProvider pinyinProvider(pinyin);
+    ZhuyinBuffer zhuyinBuffer(&zhuyinProvider);
+    ZhuyinBuffer pinyinBuffer(&pinyinProvider);
+    const auto stale = convertOnMainThread(zhuyinBuffer, keys);
+    const auto fresh = convertOnMainThread(pinyinBuffer, keys);
+    FCITX_ASSERT(stale != fresh) << stale;
+
+    ZhuyinConverter converter(TESTING_BINARY_DIR "/data", "/Invalid/Path", 1);
+    converter.publish(zhuyin, std::make_shared<ZhuyinSymbol>());
+    // Only the worker touches converted until the result is delivered.
+    size_t converted = 0;
+    converter.setConvertedHook([&converter, &converted,
+                                &pinyin](const std::string &) {
+        if (++converted == 1) {
+            converter.publish(pinyin, std::make_shared<ZhuyinSymbol>());
+        }
+    });
+    std::promise<std::string> promise;
+    auto future = promise.get_future();
+    converter.convert(keys, [&promise](std::string result) {
+        promise.set_value(std::move(result));
+    });
+    const auto result = future.get();
+    FCITX_ASSERT(result == fresh) << result << " " << fresh;
+    FCITX_ASSERT(converted == 2) << converted;
+}
+
+} // namespace
+
+int main() {
+    test_concurrent();
+    test_stale_result();
+    return 0;
+}
@@ -0,0 +1,334 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "zhuyinbuffer.h"
+#include "zhuyincandidate.h"
+#include "zhuyintestutils.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fcitx-utils/utf8.h>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Run random operation sequences against ZhuyinBuffer configured with the
+// plain code path and with every optimized path, and compare what user sees
+// after each step. A failing sequence is minimized before it is printed.
+//
+// Pending guesses are not finished between steps. Their part of the preedit
+// is provisional by design, everything else, including the length that
+// decides when the buffer is committed, has to match the reference.
+
+using namespace fcitx;
+
+namespace {
+
+// A way to drive the buffer, the first one is the reference.
+struct Variant {
+    const char *name;
+    // 1us makes every guess after the first one deferred.
+    uint64_t guessBudget;
+};
+
+constexpr Variant variants[] = {
+    {"reference", 0},
+    {"deferred-guess", 1},
+};
+
+enum class OpType {
+    Type,
+    Backspace,
+    Delete,
+    Left,
+    Right,
+    Home,
+    End,
+    Candidate,
+    Commit,
+};
+
+struct Op {
+    OpType type;
+    // Key for Type, index for Candidate.
+    uint32_t value = 0;
+};
+
+std::string opToString(const Op &op) {
+    switch (op.type) {
+    case OpType::Type:
+        return "type '" + utf8::UCS4ToUTF8(op.value) + "'";
+    case OpType::Backspace:
+        return "backspace";
+    case OpType::Delete:
+        return "delete";
+    case OpType::Left:
+        return "left";
+    case OpType::Right:
+        return "right";
+    case OpType::Home:
+        return "home";
+    case OpType::End:
+        return "end";
+    case OpType::Candidate:
+        return "candidate " + std::to_string(op.value);
+    case OpType::Commit:
+        return "commit";
+    }
+    return "";
+}
+
+std::vector<Op> randomOps(std::mt19937 &random, size_t length) {
+    // Keys of the standard layout, tones, space, and keys that always become
+    // symbol sections.
+    static const std::u32string keys =
+        U"1qaz2wsxedcrfv5tgbyhnujm8ik,9ol.0p;/-3467      !☺";
+    std::discrete_distribution<int> opDistribution(
+        {55, 10, 5, 8, 8, 2, 2, 10, 3});
+    std::uniform_int_distribution<size_t> keyDistribution(0, keys.size() - 1);
+    std::uniform_int_distribution<uint32_t> candidateDistribution(0, 20);
+    std::vector<Op> ops;
+    for (size_t i = 0; i < length; i++) {
+        Op op{static_cast<OpType>(opDistribution(random))};
+        if (op.type == OpType::Type) {
+            op.value = keys[keyDistribution(random)];
+        } else if (op.type == OpType::Candidate) {
+            op.value = candidateDistribution(random);
+        }
+        ops.push_back(op);
+    }
+    return ops;
+}
+
+// Everything user can observe after a step.
+struct Snapshot {
+    std::string preedit;
+    int cursor = 0;
+    // Preedit before this is final, see ZhuyinBuffer::settledPreeditSize.
+    size_t settled = 0;
+    size_t preeditLength = 0;
+    std::string rawText;
+    // Only set by commit.
+    std::string text;
+    std::vector<std::string> candidates;
+
+    // Whether this snapshot of an optimized variant is consistent with the
+    // one of the reference, which never has a pending guess.
+    bool matches(const Snapshot &reference) const {
+        if (rawText != reference.rawText ||
+            preeditLength != reference.preeditLength ||
+            text != reference.text || candidates != reference.candidates ||
+            reference.preedit.compare(0, settled, preedit, 0, settled) != 0) {
+            return false;
+        }
+        if (settled == preedit.size()) {
+            return preedit == reference.preedit && cursor == reference.cursor;
+        }
+        // Cursor within a pending section is counted in its provisional
+        // preedit.
+        if (static_cast<size_t>(cursor) <= settled) {
+            return cursor == reference.cursor;
+        }
+        return static_cast<size_t>(reference.cursor) > settled;
+    }
+
+    std::string toString() const {
+        std::stringstream sstream;
+        sstream << "preedit: \"" << preedit << "\" cursor: " << cursor
+                << " settled: " << settled << " length: " << preeditLength
+                << " raw: \"" << rawText << "\" text: \"" << text
+                << "\" candidates: " << candidates.size();
+        for (const auto &candidate : candidates) {
+            sstream << " " << candidate;
+        }
+        return sstream.str();
+    }
+};
+
+Snapshot apply(ZhuyinBuffer &buffer, const Op &op) {
+    Snapshot snapshot;
+    switch (op.type) {
+    case OpType::Type:
+        buffer.type(op.value);
+        break;
+    case OpType::Backspace:
+        buffer.backspace();
+        break;
+    case OpType::Delete:
+        buffer.del();
+        break;
+    case OpType::Left:
+        buffer.moveCursorLeft();
+        break;
+    case OpType::Right:
+        buffer.moveCursorRight();
+        break;
+    case OpType::Home:
+        buffer.moveCursorToBeginning();
+        break;
+    case OpType::End:
+        buffer.moveCursorToEnd();
+        break;
+    case OpType::Candidate: {
+        std::vector<std::unique_ptr<ZhuyinCandidate>> candidates;
+        buffer.showCandidate(
+            [&candidates](std::unique_ptr<ZhuyinCandidate> candidate) {
+                candidates.push_back(std::move(candidate));
+            });
+        for (const auto &candidate : candidates) {
+            snapshot.candidates.push_back(candidate->text().toString());
+        }
+        if (!candidates.empty()) {
+            candidates[op.value % candidates.size()]->select(nullptr);
+        }
+        break;
+    }
+    case OpType::Commit:
+        // Finishes pending guesses, everything is compared in full.
+        snapshot.text = buffer.text();
+        break;
+    }
+    auto preedit = buffer.preedit();
+    snapshot.preedit = preedit.toString();
+    snapshot.cursor = preedit.cursor();
+    snapshot.settled = buffer.settledPreeditSize();
+    snapshot.preeditLength = buffer.preeditLength();
+    snapshot.rawText = buffer.rawText();
+    if (op.type == OpType::Commit) {
+        buffer.reset();
+    }
+    return snapshot;
+}
+
+class DiffRunner {
+public:
+    DiffRunner() {
+        for (const auto &variant : variants) {
+            providers_.push_back(std::make_unique<TestZhuyinProvider>());
+            providers_.back()->setGuessBudget(variant.guessBudget);
+        }
+    }
+
+    // Return the index of the first step that differs, or -1.
+    int run(const std::vector<Op> &ops, std::string *message = nullptr) {
+        std::vector<std::unique_ptr<ZhuyinBuffer>> buffers;
+        for (const auto &provider : providers_) {
+            buffers.push_back(std::make_unique<ZhuyinBuffer>(provider.get()));
+        }
+        for (size_t step = 0; step < ops.size(); step++) {
+            std::vector<Snapshot> snapshots;
+            for (auto &buffer : buffers) {
+                snapshots.push_back(apply(*buffer, ops[step]));
+            }
+            for (size_t i = 1; i < snapshots.size(); i++) {
+                if (snapshots[i].matches(snapshots[0])) {
+                    continue;
+                }
+                if (message) {
+                    *message = std::string(variants[0].name) + ": " +
+                               snapshots[0].toString() + "\n" +
+                               variants[i].name + ": " +
+                               snapshots[i].toString();
+                }
+                return static_cast<int>(step);
+            }
+        }
+        return -1;
+    }
+
+    // Remove as many operations as possible while the sequence still fails.
+    std::vector<Op> minimize(std::vector<Op> ops) {
+        if (auto step = run(ops); step >= 0) {
+            ops.resize(step + 1);
+        }
+        for (size_t chunk = ops.size() / 2; chunk > 0;) {
+            bool removed = false;
+            for (size_t start = 0; start + chunk <= ops.size();) {
+                auto candidate = ops;
+                candidate.erase(candidate.begin() + start,
+                                candidate.begin() + start + chunk);
+                if (auto step = run(candidate); step >= 0) {
+                    candidate.resize(step + 1);
+                    ops = std::move(candidate);
+                    removed = true;
+                } else {
+                    start += chunk;
+                }
+            }
+            if (!removed) {
+                chunk /= 2;
+            }
+        }
+        return ops;
+    }
+
+private:
+    std::vector<std::unique_ptr<TestZhuyinProvider>> providers_;
+};
+
+void usage(const char *argv0) {
+    std::cout << "Usage: " << argv0
+              << " [-s <seed>] [-n <runs>] [-l <length>]\n"
+              << "-s: random seed\n"
+              << "-n: number of operation sequences\n"
+              << "-l: number of operations in each sequence\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    uint32_t seed = 1;
+    size_t runs = 100;
+    size_t length = 60;
+    int c;
+    while ((c = getopt(argc, argv, "s:n:l:h")) != -1) {
+        switch (c) {
+        case 's':
+            seed = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'n':
+            runs = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'l':
+            length = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    DiffRunner runner;
+    std::mt19937 random(seed);
+    for (size_t i = 0; i < runs; i++) {
+        auto ops = randomOps(random, length);
+        if (runner.run(ops) < 0) {
+            continue;
+        }
+        ops = runner.minimize(std::move(ops));
+        std::string message;
+        runner.run(ops, &message);
+        std::cout << "Sequence " << i << " of seed " << seed
+                  << " diverges, minimized to " << ops.size()
+                  << " operations:\n";
+        for (const auto &op : ops) {
+            std::cout << "  " << opToString(op) << '\n';
+        }
+        std::cout << message << '\n';
+        return 1;
+    }
+    std::cout << "No divergence in " << runs << " sequences of " << length
+              << " operations, seed " << seed << '\n';
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "zhuyinsymbol.h"
+#include <chrono>
+#include <cstddef>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/stringutils.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+std::vector<std::string> search(const ZhuyinSymbol &symbol,
+                                std::string_view prefix) {
+    std::vector<std::string> result;
+    symbol.search(prefix, [&result](const std::string & /*key*/,
+                                    const std::string &symbol) {
+        result.push_back(symbol);
+        return true;
+    });
+    return result;
+}
+
+bool contains(const std::vector<std::string> &symbols,
+              const std::string &symbol) {
+    for (const auto &item : symbols) {
+        if (item == symbol) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void test_search() {
+    ZhuyinSymbol symbol;
+    std::istringstream in("L Orz\nheart ♥\nhelp ？\n");
+    symbol.load(in);
+
+    // Symbols in a builtin group come with the rest of the group.
+    auto result = search(symbol, "he");
+    const std::vector<std::string> he = {"♥", "Η", "η", "？", "¿"};
+    FCITX_ASSERT(result == he) << result;
+    result = search(symbol, "HEA");
+    const std::vector<std::string> hea = {"♥", "Η", "η"};
+    FCITX_ASSERT(result == hea) << result;
+    FCITX_ASSERT(contains(search(symbol, "l"), "Orz"));
+    // Category names.
+    FCITX_ASSERT(contains(search(symbol, "gre"), "α"));
+    FCITX_ASSERT(contains(search(symbol, "doubleb"), "═"));
+    FCITX_ASSERT(search(symbol, "nothing").empty());
+
+    // Stop early.
+    size_t count = 0;
+    symbol.search("", [&count](const std::string &, const std::string &) {
+        return ++count < 3;
+    });
+    FCITX_ASSERT(count == 3);
+}
+
+void test_search_large() {
+    ZhuyinSymbol symbol;
+    std::stringstream in;
+    for (size_t i = 0; i < 5000; i++) {
+        in << "key" << i << " ☆" << i << "\n";
+    }
+    symbol.load(in);
+
+    const std::vector<std::string> prefixes = {"k",    "ke",   "key",
+                                               "key1", "key12", "key123"};
+    constexpr size_t rounds = 1000;
+    size_t matches = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++) {
+        for (const auto &prefix : prefixes) {
+            // Like QuickPhrase, only take the first page.
+            size_t count = 0;
+            symbol.search(prefix, [&count](const std::string &,
+                                           const std::string &) {
+                return ++count < 10;
+            });
+            matches += count;
+        }
+    }
+    const auto elapsed = std::chrono::duration<double, std::micro>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    FCITX_ASSERT(matches == rounds * prefixes.size() * 10);
+    FCITX_INFO() << "Search takes " << elapsed / (rounds * prefixes.size())
+                 << "us per key";
+    FCITX_ASSERT(search(symbol, "key4999") ==
+                 std::vector<std::string>{"☆4999"});
+}
+
+} // namespace
+
+int main() {
+    test_search();
+    test_search_large();
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#include "testdir.h"
+#include "zhuyinuserdict.h"
+#include <cstdlib>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/misc.h>
+#include <filesystem>
+#include <glib.h>
+#include <string>
+#include <vector>
+#include <zhuyin.h>
+
+using namespace fcitx;
+
+namespace {
+
+size_t countUserPhrases(zhuyin_context_t *context) {
+    size_t count = 0;
+    auto *iter = zhuyin_begin_get_phrases(context, USER_DICTIONARY);
+    FCITX_ASSERT(iter);
+    while (zhuyin_iterator_has_next_phrase(iter)) {
+        gchar *phrase = nullptr;
+        gchar *zhuyin = nullptr;
+        gint n = 0;
+        if (zhuyin_iterator_get_next_phrase(iter, &phrase, &zhuyin, &n)) {
+            count += 1;
+        }
+        g_free(phrase);
+        g_free(zhuyin);
+    }
+    zhuyin_end_get_phrases(iter);
+    return count;
+}
+
+} // namespace
+
+int main() {
+    char userDirTemplate[] = "/tmp/testzhuyinuserdictXXXXXX";
+    FCITX_ASSERT(mkdtemp(userDirTemplate));
+    const std::string userDir = userDirTemplate;
+    const std::string systemDir = TESTING_BINARY_DIR "/data";
+
+    {
+        UniqueCPtr<zhuyin_context_t, zhuyin_fini> context(
+            zhuyin_init(systemDir.data(), userDir.data()));
+        FCITX_ASSERT(context);
+        zhuyin_load_phrase_library(context.get(), USER_DICTIONARY);
+        auto *iter = zhuyin_begin_add_phrases(context.get(), USER_DICTIONARY);
+        FCITX_ASSERT(iter);
+        zhuyin_iterator_add_phrase(iter, "妳好", "ㄋㄧˇ ㄏㄠˇ", 1);
+        zhuyin_iterator_add_phrase(iter, "泥濘", "ㄋㄧˊ ㄋㄧㄥˋ", 3);
+        zhuyin_iterator_add_phrase(iter, "尼好", "ㄋㄧˊ ㄏㄠˇ", 5);
+        zhuyin_end_add_phrases(iter);
+        zhuyin_save(context.get());
+    }
+
+    // The default policy keeps everything.
+    auto kept = compactUserDictionary(systemDir, userDir, {});
+    FCITX_ASSERT(kept.success);
+    FCITX_ASSERT(kept.phrasesBefore == 3) << kept.phrasesBefore;
+    FCITX_ASSERT(kept.phrasesAfter == 3) << kept.phrasesAfter;
+    FCITX_ASSERT(countUserPhrases(kept.context.get()) == 3);
+    kept.context.reset();
+
+    ZhuyinCompactPolicy policy;
+    policy.minCount = 2;
+    policy.maxPhrases = 1;
+    auto result = compactUserDictionary(systemDir, userDir, policy);
+    FCITX_INFO() << result.toString();
+    FCITX_ASSERT(result.success);
+    FCITX_ASSERT(result.phrasesBefore == 3) << result.phrasesBefore;
+    // 妳好 is used fewer than minCount, and only the most used one of the
+    // rest fits maxPhrases.
+    FCITX_ASSERT(result.phrasesAfter == 1) << result.phrasesAfter;
+    FCITX_ASSERT(countUserPhrases(result.context.get()) == 1);
+    FCITX_ASSERT(result.sizeAfter > 0);
+    FCITX_ASSERT(userDictionarySize(userDir) == result.sizeAfter);
+
+    result.context.reset();
+
+    std::vector<ZhuyinSentence> sentences{
+        {"su3cl3", {{0, 6, "你好"}}}, {"rup", {}}, {"a\tb", {}}};
+    FCITX_ASSERT(appendUntrained(userDir, "zhuyin", sentences));
+    FCITX_ASSERT(appendUntrained(userDir, "zhuyin-hanyu", {{"ni3", {}}}));
+    auto untrained = loadUntrained(userDir);
+    FCITX_ASSERT(untrained.size() == 2) << untrained.size();
+    FCITX_ASSERT(untrained[0].first == "zhuyin");
+    // Input with a tab is not kept.
+    FCITX_ASSERT(untrained[0].second.size() == 2);
+    FCITX_ASSERT(untrained[0].second[0].input == "su3cl3");
+    FCITX_ASSERT(untrained[0].second[0].choices.size() == 1);
+    FCITX_ASSERT(untrained[0].second[0].choices[0].end == 6);
+    FCITX_ASSERT(untrained[0].second[0].choices[0].text == "你好");
+    FCITX_ASSERT(untrained[0].second[1].choices.empty());
+    FCITX_ASSERT(untrained[1].first == "zhuyin-hanyu");
+    FCITX_ASSERT(untrained[1].second[0].input == "ni3");
+    removeUntrained(userDir);
+    FCITX_ASSERT(loadUntrained(userDir).empty());
+
+    std::filesystem::remove_all(userDir);
+    return 0;
+}
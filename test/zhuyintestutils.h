@@ -0,0 +1,137 @@
+/*
+ * SPDX-FileCopyrightText: 2020~2020 CSSlayer <wengxt@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+#ifndef _FCITX5_ZHUYIN_TEST_ZHUYINTESTUTILS_H_
+#define _FCITX5_ZHUYIN_TEST_ZHUYINTESTUTILS_H_
+
+// Helpers shared by the tests and the measurement tools.
+
+#include "testdir.h"
+#include "zhuyinbuffer.h"
+#include "zhuyinoptions.h"
+#include "zhuyinsymbol.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fcitx-utils/misc.h>
+#include <fcitx-utils/utf8.h>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <zhuyin.h>
+
+namespace fcitx {
+
+// Standard layout with tone required, what most tests are written for.
+inline ZhuyinContextOptions testContextOptions() {
+    ZhuyinContextOptions options;
+    options.scheme = ZHUYIN_STANDARD;
+    options.options =
+        USE_TONE | ZHUYIN_CORRECT_ALL | FORCE_TONE | DYNAMIC_ADJUST;
+    return options;
+}
+
+class TestZhuyinProvider : public ZhuyinProviderInterface {
+public:
+    // Load the model from dataDir, context() is null if it fails.
+    explicit TestZhuyinProvider(
+        const ZhuyinContextOptions &options = testContextOptions(),
+        const std::string &dataDir = TESTING_BINARY_DIR "/data",
+        const std::string &userDir = "/Invalid/Path")
+        : isZhuyin_(options.isZhuyin) {
+        ownedContext_.reset(zhuyin_init(dataDir.data(), userDir.data()));
+        context_ = ownedContext_.get();
+        if (context_) {
+            options.apply(context_);
+        }
+    }
+    // Use a context owned by the caller, with its options as they are.
+    explicit TestZhuyinProvider(zhuyin_context_t *context,
+                                bool isZhuyin = true)
+        : isZhuyin_(isZhuyin), context_(context) {}
+
+    zhuyin_context_t *context() override { return context_; }
+    bool isZhuyin() const override { return isZhuyin_; }
+    const ZhuyinSymbol &symbol() const override { return symbol_; }
+    uint64_t guessBudget() const override { return guessBudget_; }
+    void setGuessBudget(uint64_t budget) { guessBudget_ = budget; }
+    // Every read of the clock moves it by step usec, so each guess takes
+    // exactly step usec. 0 uses the real clock.
+    uint64_t guessClock() const override {
+        if (!clockStep_) {
+            return ZhuyinProviderInterface::guessClock();
+        }
+        return clock_ += clockStep_;
+    }
+    void setClockStep(uint64_t step) { clockStep_ = step; }
+
+private:
+    bool isZhuyin_;
+    uint64_t guessBudget_ = 0;
+    uint64_t clockStep_ = 0;
+    mutable uint64_t clock_ = 0;
+    ZhuyinSymbol symbol_;
+    UniqueCPtr<zhuyin_context_t, zhuyin_fini> ownedContext_;
+    zhuyin_context_t *context_ = nullptr;
+};
+
+class Timer {
+public:
+    Timer() : start_(std::chrono::steady_clock::now()) {}
+    // Usec since construction.
+    double elapsed() const {
+        return std::chrono::duration<double, std::micro>(
+                   std::chrono::steady_clock::now() - start_)
+            .count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+inline double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[static_cast<size_t>(p * (values.size() - 1) + 0.5)];
+}
+
+// A line of corpus.txt, key sequence and the text it is expected to type.
+struct CorpusEntry {
+    std::string keys;
+    std::string text;
+};
+
+// Comments, lines without keys or text, and invalid UTF-8 are skipped.
+inline std::vector<CorpusEntry> loadCorpus(const std::string &path) {
+    std::vector<CorpusEntry> entries;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        auto tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == 0 ||
+            tab == std::string::npos || !utf8::validate(line)) {
+            continue;
+        }
+        entries.push_back({line.substr(0, tab), line.substr(tab + 1)});
+    }
+    return entries;
+}
+
+inline std::vector<std::string> loadCorpusKeys(const std::string &path) {
+    std::vector<std::string> keys;
+    for (auto &entry : loadCorpus(path)) {
+        keys.push_back(std::move(entry.keys));
+    }
+    return keys;
+}
+
+} // namespace fcitx
+
+#endif // _FCITX5_ZHUYIN_TEST_ZHUYINTESTUTILS_H_